@@ -43,6 +43,10 @@ __FBSDID("$FreeBSD$");
 #include <sys/filio.h>
 #include <sys/unistd.h>
 #include <sys/capsicum.h>
+#include <sys/event.h>
+#include <sys/poll.h>
+#include <sys/selinfo.h>
+#include <sys/taskqueue.h>
 
 #include <vm/vm.h>
 #include <vm/pmap.h>
@@ -71,6 +75,7 @@ static fo_stat_t dma_buf_stat;
 static fo_fill_kinfo_t dma_buf_fill_kinfo;
 static fo_mmap_t dma_buf_mmap_fileops;
 static fo_poll_t dma_buf_poll;
+static fo_kqfilter_t dma_buf_kqfilter;
 static fo_seek_t dma_buf_seek;
 static fo_ioctl_t dma_buf_ioctl;
 
@@ -80,6 +85,7 @@ struct fileops dma_buf_fileops  = {
 	.fo_fill_kinfo = dma_buf_fill_kinfo,
 	.fo_mmap = dma_buf_mmap_fileops,
 	.fo_poll = dma_buf_poll,
+	.fo_kqfilter = dma_buf_kqfilter,
 	.fo_seek = dma_buf_seek,
 	.fo_ioctl = dma_buf_ioctl,
 	.fo_flags = DFLAG_PASSABLE|DFLAG_SEEKABLE,
@@ -90,6 +96,8 @@ struct fileops dma_buf_fileops  = {
 
 #define fp_is_db(fp) ((fp)->f_ops == &dma_buf_fileops)
 
+static void dma_buf_poll_cb_fini(struct dma_buf_poll_cb_t *dcb);
+
 static int
 dma_buf_close(struct file *fp, struct thread *td)
 {
@@ -100,8 +108,13 @@ dma_buf_close(struct file *fp, struct thread *td)
 
 	db = fp->f_data;
 
-	MPASS(db->cb_shared.active == 0);
-	MPASS(db->cb_excl.active == 0);
+	/* stop pending poll wakeups */
+	dma_buf_poll_cb_fini(&db->cb_excl);
+	dma_buf_poll_cb_fini(&db->cb_shared);
+	taskqueue_drain(taskqueue_thread, &db->poll_task);
+	seldrain(&db->poll_sel);
+	knlist_destroy(&db->poll_sel.si_note);
+	mtx_destroy(&db->poll_mtx);
 
 	/* release DMA buffer */
 	db->ops->release(db);
@@ -184,11 +197,234 @@ dma_buf_seek(struct file *fp, off_t offset, int whence, struct thread *td)
 	return (0);
 }
 
+/*
+ * Readiness follows the implicit fences in the reservation object: a buffer
+ * is readable once its exclusive (write) fence has signaled, and writable
+ * once all of its shared (read) fences, or the exclusive fence if there are
+ * none, have signaled. While it isn't, a callback is armed on the first
+ * unsignaled fence. The callback runs under the fence lock and may not take
+ * poll_mtx, which is held while arming, so it only defers the wakeup of
+ * select and kqueue waiters to a task.
+ */
+static void
+dma_buf_poll_cb(struct dma_fence *fence, struct dma_fence_cb *cb)
+{
+	struct dma_buf_poll_cb_t *dcb;
+
+	dcb = container_of(cb, struct dma_buf_poll_cb_t, cb);
+	WRITE_ONCE(dcb->active, 0);
+	taskqueue_enqueue(taskqueue_thread, &dcb->db->poll_task);
+}
+
+static void
+dma_buf_poll_task(void *arg, int pending __unused)
+{
+	struct dma_buf *db;
+
+	db = arg;
+	mtx_lock(&db->poll_mtx);
+	KNOTE_LOCKED(&db->poll_sel.si_note, 0);
+	mtx_unlock(&db->poll_mtx);
+	selwakeup(&db->poll_sel);
+}
+
+static void
+dma_buf_poll_cb_init(struct dma_buf *db, struct dma_buf_poll_cb_t *dcb)
+{
+
+	INIT_LIST_HEAD(&dcb->cb.node);
+	dcb->db = db;
+	dcb->fence = NULL;
+	dcb->active = 0;
+}
+
+static void
+dma_buf_poll_cb_fini(struct dma_buf_poll_cb_t *dcb)
+{
+
+	if (dcb->fence == NULL)
+		return;
+	dma_fence_remove_callback(dcb->fence, &dcb->cb);
+	dma_fence_put(dcb->fence);
+	dcb->fence = NULL;
+	dcb->active = 0;
+}
+
+/*
+ * Returns a reference on the first unsignaled fence a reader (exclusive
+ * fence only) or writer (shared fences, or the exclusive one if there are
+ * none) has to wait for, or NULL if the buffer is ready.
+ */
+static struct dma_fence *
+dma_buf_poll_fence(struct dma_resv *resv, bool write)
+{
+	struct dma_resv_list *fobj;
+	struct dma_fence *fence;
+	unsigned int i, seq, shared_count;
+
+	rcu_read_lock();
+retry:
+	seq = read_seqcount_begin(&resv->seq);
+	shared_count = 0;
+	if (write) {
+		fobj = rcu_dereference(resv->fence);
+		if (fobj != NULL)
+			shared_count = fobj->shared_count;
+		for (i = 0; i < shared_count; i++) {
+			fence = dma_fence_get_rcu(
+			    rcu_dereference(fobj->shared[i]));
+			if (fence == NULL)
+				goto retry;
+			if (!dma_fence_is_signaled(fence))
+				goto found;
+			dma_fence_put(fence);
+		}
+	}
+	if (shared_count == 0) {
+		fence = rcu_dereference(resv->fence_excl);
+		if (fence != NULL) {
+			fence = dma_fence_get_rcu(fence);
+			if (fence == NULL)
+				goto retry;
+			if (!dma_fence_is_signaled(fence))
+				goto found;
+			dma_fence_put(fence);
+		}
+	}
+	if (read_seqcount_retry(&resv->seq, seq))
+		goto retry;
+	rcu_read_unlock();
+	return (NULL);
+
+found:
+	rcu_read_unlock();
+	return (fence);
+}
+
+/*
+ * Check whether the buffer is ready for reading or writing and, if it is
+ * not, make sure a callback is armed to wake up the waiters once it may be.
+ * Called with poll_mtx held.
+ */
+static bool
+dma_buf_poll_ready(struct dma_buf *db, bool write)
+{
+	struct dma_buf_poll_cb_t *dcb;
+	struct dma_fence *fence;
+
+	mtx_assert(&db->poll_mtx, MA_OWNED);
+
+	dcb = write ? &db->cb_shared : &db->cb_excl;
+	for (;;) {
+		fence = dma_buf_poll_fence(db->resv, write);
+		if (fence == NULL)
+			return (true);
+
+		/* Already armed, the callback will wake us up. */
+		if (READ_ONCE(dcb->active)) {
+			dma_fence_put(fence);
+			return (false);
+		}
+
+		if (dcb->fence != NULL)
+			dma_fence_put(dcb->fence);
+		dcb->fence = fence;
+		dcb->active = 1;
+		if (dma_fence_add_callback(fence, &dcb->cb,
+		    dma_buf_poll_cb) == 0)
+			return (false);
+
+		/* Signaled in the meantime, look at the next fence. */
+		dcb->active = 0;
+	}
+}
+
 static int
 dma_buf_poll(struct file *fp, int events,
 	     struct ucred *active_cred, struct thread *td)
 {
-	panic("XXX implement me!!!");
+	struct dma_buf *db;
+	int revents;
+
+	if (!fp_is_db(fp))
+		return (POLLERR);
+
+	db = fp->f_data;
+	revents = 0;
+
+	mtx_lock(&db->poll_mtx);
+	if ((events & (POLLIN | POLLRDNORM)) != 0 &&
+	    dma_buf_poll_ready(db, false))
+		revents |= events & (POLLIN | POLLRDNORM);
+	if ((events & (POLLOUT | POLLWRNORM)) != 0 &&
+	    dma_buf_poll_ready(db, true))
+		revents |= events & (POLLOUT | POLLWRNORM);
+	if (revents == 0 &&
+	    (events & (POLLIN | POLLRDNORM | POLLOUT | POLLWRNORM)) != 0)
+		selrecord(td, &db->poll_sel);
+	mtx_unlock(&db->poll_mtx);
+
+	return (revents);
+}
+
+static void
+dma_buf_kqops_detach(struct knote *kn)
+{
+	struct dma_buf *db;
+
+	db = kn->kn_hook;
+	knlist_remove(&db->poll_sel.si_note, kn, 0);
+}
+
+static int
+dma_buf_kqops_read_event(struct knote *kn, long hint)
+{
+
+	return (dma_buf_poll_ready(kn->kn_hook, false));
+}
+
+static int
+dma_buf_kqops_write_event(struct knote *kn, long hint)
+{
+
+	return (dma_buf_poll_ready(kn->kn_hook, true));
+}
+
+static struct filterops dma_buf_kqops_read = {
+	.f_isfd = 1,
+	.f_detach = dma_buf_kqops_detach,
+	.f_event = dma_buf_kqops_read_event,
+};
+
+static struct filterops dma_buf_kqops_write = {
+	.f_isfd = 1,
+	.f_detach = dma_buf_kqops_detach,
+	.f_event = dma_buf_kqops_write_event,
+};
+
+static int
+dma_buf_kqfilter(struct file *fp, struct knote *kn)
+{
+	struct dma_buf *db;
+
+	if (!fp_is_db(fp))
+		return (EINVAL);
+
+	db = fp->f_data;
+
+	switch (kn->kn_filter) {
+	case EVFILT_READ:
+		kn->kn_fop = &dma_buf_kqops_read;
+		break;
+	case EVFILT_WRITE:
+		kn->kn_fop = &dma_buf_kqops_write;
+		break;
+	default:
+		return (EINVAL);
+	}
+	kn->kn_hook = db;
+	knlist_add(&db->poll_sel.si_note, kn, 0);
+
 	return (0);
 }
 
@@ -272,6 +508,8 @@ dma_buf_attach(struct dma_buf *db, struct device *dev)
 
 	if ((dba = malloc(sizeof(*dba), M_DMABUF, M_NOWAIT|M_ZERO)) == NULL)
 		return (ERR_PTR(-ENOMEM));
+	dba->dmabuf = db;
+	dba->dev = dev;
 	
 	sx_xlock(&db->lock.sx);
 	if (db->ops->attach) {
@@ -370,9 +608,11 @@ dma_buf_export(const struct dma_buf_export_info *exp_info)
 	db->size = exp_info->size;
 	db->exp_name = exp_info->exp_name;
 	db->owner = exp_info->owner;
-	init_waitqueue_head(&db->poll);
-	db->cb_excl.poll = db->cb_shared.poll = &db->poll;
-	db->cb_excl.active = db->cb_shared.active = 0;
+	mtx_init(&db->poll_mtx, "dmabufpoll", NULL, MTX_DEF);
+	knlist_init_mtx(&db->poll_sel.si_note, &db->poll_mtx);
+	TASK_INIT(&db->poll_task, 0, dma_buf_poll_task, db);
+	dma_buf_poll_cb_init(db, &db->cb_excl);
+	dma_buf_poll_cb_init(db, &db->cb_shared);
 
 	if (ro == NULL) {
 		ro = (struct dma_resv *)&db[1];
@@ -394,6 +634,8 @@ dma_buf_export(const struct dma_buf_export_info *exp_info)
 
 	return (db);
 err:	
+	knlist_destroy(&db->poll_sel.si_note);
+	mtx_destroy(&db->poll_mtx);
 	free(db, M_DMABUF);
 	return (ERR_PTR(-err));
 }
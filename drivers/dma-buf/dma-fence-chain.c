@@ -92,7 +92,8 @@ EXPORT_SYMBOL(dma_fence_chain_walk);
  */
 int dma_fence_chain_find_seqno(struct dma_fence **pfence, uint64_t seqno)
 {
-	struct dma_fence_chain *chain;
+	struct dma_fence_chain *chain, *skip;
+	struct dma_fence *fence;
 
 	if (!seqno)
 		return 0;
@@ -101,11 +102,27 @@ int dma_fence_chain_find_seqno(struct dma_fence **pfence, uint64_t seqno)
 	if (!chain || chain->base.seqno < seqno)
 		return -EINVAL;
 
-	dma_fence_chain_for_each(*pfence, &chain->base) {
-		if ((*pfence)->context != chain->base.context ||
-		    to_dma_fence_chain(*pfence)->prev_seqno < seqno)
+	fence = dma_fence_get(&chain->base);
+	while (fence) {
+		if (fence->context != chain->base.context ||
+		    to_dma_fence_chain(fence)->prev_seqno < seqno)
 			break;
+
+		/*
+		 * Every node between here and the skip target has a
+		 * prev_seqno of at least the target's seqno, so jump over
+		 * them whenever the target is still not too old.
+		 */
+		skip = to_dma_fence_chain(fence)->skip;
+		if (skip && skip->base.seqno >= seqno) {
+			dma_fence_get(&skip->base);
+			dma_fence_put(fence);
+			fence = &skip->base;
+		} else {
+			fence = dma_fence_chain_walk(fence);
+		}
 	}
+	*pfence = fence;
 	dma_fence_put(&chain->base);
 
 	return 0;
@@ -206,6 +223,8 @@ static void dma_fence_chain_release(struct dma_fence *fence)
 	}
 	dma_fence_put(prev);
 
+	if (chain->skip)
+		dma_fence_put(&chain->skip->base);
 	dma_fence_put(chain->fence);
 	dma_fence_free(fence);
 }
@@ -220,6 +239,60 @@ const struct dma_fence_ops dma_fence_chain_ops = {
 };
 EXPORT_SYMBOL(dma_fence_chain_ops);
 
+/*
+ * Depth of the skip target of the node at @depth: clear the lowest set bit,
+ * or for odd depths the two lowest set bits of @depth - 1. This gives every
+ * node one pointer back by a varying power of two, which is enough to find
+ * any older node of the timeline in a logarithmic number of steps.
+ */
+static u64 dma_fence_chain_skip_depth(u64 depth)
+{
+	if (depth < 2)
+		return 0;
+
+	if (depth & 1) {
+		depth -= 1;
+		depth &= depth - 1;
+		return (depth & (depth - 1)) + 1;
+	}
+
+	return depth & (depth - 1);
+}
+
+/*
+ * Returns a reference to the newest node of @chain's timeline which is no
+ * deeper than @depth, or NULL if there is none. Garbage collection may have
+ * unlinked the node at exactly @depth, any older one is fine as skip target.
+ */
+static struct dma_fence_chain *dma_fence_chain_ancestor(struct dma_fence_chain *chain,
+							u64 depth)
+{
+	struct dma_fence *fence, *next;
+	struct dma_fence_chain *node;
+
+	fence = dma_fence_get(&chain->base);
+	while ((node = to_dma_fence_chain(fence)) && node->depth > depth) {
+		if (node->skip && node->skip->depth >= depth)
+			next = dma_fence_get(&node->skip->base);
+		else
+			next = dma_fence_chain_get_prev(node);
+		dma_fence_put(fence);
+		fence = next;
+
+		if (fence && fence->context != chain->base.context) {
+			dma_fence_put(fence);
+			return NULL;
+		}
+	}
+
+	if (fence && !node) {
+		dma_fence_put(fence);
+		return NULL;
+	}
+
+	return node;
+}
+
 /**
  * dma_fence_chain_init - initialize a fence chain
  * @chain: the chain node to initialize
@@ -256,5 +329,14 @@ void dma_fence_chain_init(struct dma_fence_chain *chain,
 
 	dma_fence_init(&chain->base, &dma_fence_chain_ops,
 		       &chain->lock, context, seqno);
+
+	/* Nodes continuing a timeline link back into it for lookups */
+	chain->depth = 0;
+	chain->skip = NULL;
+	if (prev_chain && context == prev->context) {
+		chain->depth = prev_chain->depth + 1;
+		chain->skip = dma_fence_chain_ancestor(prev_chain,
+			dma_fence_chain_skip_depth(chain->depth));
+	}
 }
 EXPORT_SYMBOL(dma_fence_chain_init);
@@ -25,10 +25,21 @@ EXPORT_TRACEPOINT_SYMBOL(dma_fence_emit);
 EXPORT_TRACEPOINT_SYMBOL(dma_fence_enable_signal);
 EXPORT_TRACEPOINT_SYMBOL(dma_fence_signaled);
 #elif defined(__FreeBSD__)
+#include <sys/param.h>
+#include <sys/malloc.h>
+#include <sys/sbuf.h>
+#include <sys/sysctl.h>
+
 #include <linux/lockdep.h>	/* For lockded_assert_hold (manu 20200511) */
-#define trace_dma_fence_init(x)
+#include <linux/moduleparam.h>
+#include <linux/dma-fence-chain.h>
+
+static void dma_fence_stats_init(struct dma_fence *fence);
+static void dma_fence_stats_enable(struct dma_fence *fence);
+
+#define trace_dma_fence_init(x)		dma_fence_stats_init(x)
 #define trace_dma_fence_destroy(x)
-#define trace_dma_fence_enable_signal(x)
+#define trace_dma_fence_enable_signal(x) dma_fence_stats_enable(x)
 #define trace_dma_fence_signaled(x)
 #define trace_dma_fence_wait_start(x)
 #define trace_dma_fence_wait_end(x)
@@ -37,6 +48,277 @@ EXPORT_TRACEPOINT_SYMBOL(dma_fence_signaled);
 static DEFINE_SPINLOCK(dma_fence_stub_lock);
 static struct dma_fence dma_fence_stub;
 
+#ifdef __FreeBSD__
+/*
+ * Optional per fence context statistics, see compat.linuxkpi.dma_fence.
+ *
+ * Fences initialized while stats are enabled carry their init and
+ * enable_signaling times; signaling them adds the latencies to log2
+ * histograms of their context.  Contexts live in a fixed size open
+ * addressing table which is only cleared through the reset sysctl, so
+ * nothing is allocated or locked on the signaling path.  Context slots,
+ * and with them the driver and timeline names, are claimed in
+ * dma_fence_init() and at enable_signaling time only, as some drivers
+ * rename their timeline once a fence is signaled.  Signaling only updates
+ * an existing slot.  While stats are enabled, dma_fence_init() therefore
+ * also probes the table, and calls the name callbacks for the first fence
+ * of each context.
+ */
+#define	DMA_FENCE_STATS_CONTEXTS	512
+#define	DMA_FENCE_STATS_PROBES		8
+#define	DMA_FENCE_STATS_BUCKETS		24	/* log2(us), up to ~8s */
+
+struct dma_fence_ctx_stats {
+	atomic64_t context;		/* 0 while unused */
+	char driver[16];
+	char timeline[32];
+	atomic64_t signaled;
+	atomic64_t callbacks;
+	atomic_t callbacks_max;
+	atomic64_t signal_hist[DMA_FENCE_STATS_BUCKETS];
+	atomic64_t enable_hist[DMA_FENCE_STATS_BUCKETS];
+};
+
+static MALLOC_DEFINE(M_DMA_FENCE_STATS, "dma_fence_stats",
+    "DMA fence context statistics");
+
+static struct dma_fence_ctx_stats *dma_fence_stats;
+static int dma_fence_stats_enabled;
+static atomic64_t dma_fence_stats_dropped;
+
+static SYSCTL_NODE(_compat_linuxkpi, OID_AUTO, dma_fence,
+    CTLFLAG_RW | CTLFLAG_MPSAFE, 0, "DMA fence statistics");
+
+static struct dma_fence_ctx_stats *
+dma_fence_stats_lookup(struct dma_fence *fence, bool claim);
+
+static void
+dma_fence_stats_init(struct dma_fence *fence)
+{
+	fence->init_time = READ_ONCE(dma_fence_stats_enabled) ?
+	    ktime_get() : 0;
+	fence->enable_time = 0;
+	if (fence->init_time != 0)
+		(void)dma_fence_stats_lookup(fence, true);
+}
+
+static inline unsigned int
+dma_fence_stats_bucket(ktime_t delta)
+{
+	s64 us = ktime_to_us(delta);
+
+	if (us <= 0)
+		return (0);
+	return (min_t(unsigned int, fls64(us), DMA_FENCE_STATS_BUCKETS - 1));
+}
+
+/*
+ * Returns the statistics slot of the fence's context. Only @claim allocates
+ * a new slot, as the names are captured then: some drivers, like i915,
+ * report a different timeline name once the fence is signaled.
+ */
+static struct dma_fence_ctx_stats *
+dma_fence_stats_lookup(struct dma_fence *fence, bool claim)
+{
+	struct dma_fence_ctx_stats *st, *table;
+	unsigned int i, idx;
+	u64 ctx;
+
+	/* Containers only forward the signaling of their members. */
+	table = READ_ONCE(dma_fence_stats);
+	if (table == NULL || fence->context == 0 ||
+	    dma_fence_is_array(fence) || fence->ops == &dma_fence_chain_ops)
+		return (NULL);
+
+	idx = (fence->context * 0x9e3779b97f4a7c15ULL) >> 55;
+	for (i = 0; i < DMA_FENCE_STATS_PROBES; i++) {
+		st = &table[(idx + i) % DMA_FENCE_STATS_CONTEXTS];
+		ctx = atomic64_read(&st->context);
+		if (ctx == fence->context)
+			return (st);
+		if (!claim)
+			continue;
+		if (ctx != 0 ||
+		    atomic64_cmpxchg(&st->context, 0, fence->context) != 0)
+			continue;
+		strlcpy(st->driver, fence->ops->get_driver_name(fence),
+		    sizeof(st->driver));
+		strlcpy(st->timeline, fence->ops->get_timeline_name(fence),
+		    sizeof(st->timeline));
+		return (st);
+	}
+	if (claim)
+		atomic64_inc(&dma_fence_stats_dropped);
+
+	return (NULL);
+}
+
+static void
+dma_fence_stats_enable(struct dma_fence *fence)
+{
+	if (fence->init_time == 0)
+		return;
+	fence->enable_time = ktime_get();
+	(void)dma_fence_stats_lookup(fence, true);
+}
+
+static struct dma_fence_ctx_stats *
+dma_fence_stats_signal(struct dma_fence *fence)
+{
+	struct dma_fence_ctx_stats *st;
+
+	if (likely(fence->init_time == 0))
+		return (NULL);
+	st = dma_fence_stats_lookup(fence, false);
+	if (st == NULL)
+		return (NULL);
+
+	atomic64_inc(&st->signaled);
+	atomic64_inc(&st->signal_hist[dma_fence_stats_bucket(
+	    ktime_sub(fence->timestamp, fence->init_time))]);
+	if (fence->enable_time != 0)
+		atomic64_inc(&st->enable_hist[dma_fence_stats_bucket(
+		    ktime_sub(fence->timestamp, fence->enable_time))]);
+
+	return (st);
+}
+
+static void
+dma_fence_stats_callbacks(struct dma_fence_ctx_stats *st, unsigned int count)
+{
+	int max;
+
+	atomic64_add(count, &st->callbacks);
+	while ((max = atomic_read(&st->callbacks_max)) < (int)count &&
+	    atomic_cmpxchg(&st->callbacks_max, max, count) != max)
+		;
+}
+
+static int
+dma_fence_stats_sysctl_enable(SYSCTL_HANDLER_ARGS)
+{
+	struct dma_fence_ctx_stats *table;
+	int error, val;
+
+	val = dma_fence_stats_enabled;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error != 0 || req->newptr == NULL)
+		return (error);
+
+	/* The table is kept until unload once allocated. */
+	if (val != 0 && dma_fence_stats == NULL) {
+		table = malloc(sizeof(*table) * DMA_FENCE_STATS_CONTEXTS,
+		    M_DMA_FENCE_STATS, M_WAITOK | M_ZERO);
+		if (atomic_cmpset_rel_ptr((volatile uintptr_t *)&dma_fence_stats,
+		    (uintptr_t)NULL, (uintptr_t)table) == 0)
+			free(table, M_DMA_FENCE_STATS);
+	}
+	WRITE_ONCE(dma_fence_stats_enabled, val != 0);
+
+	return (0);
+}
+SYSCTL_PROC(_compat_linuxkpi_dma_fence, OID_AUTO, stats,
+    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+    dma_fence_stats_sysctl_enable, "I",
+    "Record per context signaling statistics for new fences");
+
+static int
+dma_fence_stats_sysctl_reset(SYSCTL_HANDLER_ARGS)
+{
+	struct dma_fence_ctx_stats *table;
+	int error, val;
+
+	val = 0;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error != 0 || req->newptr == NULL || val == 0)
+		return (error);
+
+	/* Racing signalers may leave a few counts behind. */
+	table = READ_ONCE(dma_fence_stats);
+	if (table != NULL)
+		memset(table, 0, sizeof(*table) * DMA_FENCE_STATS_CONTEXTS);
+	atomic64_set(&dma_fence_stats_dropped, 0);
+
+	return (0);
+}
+SYSCTL_PROC(_compat_linuxkpi_dma_fence, OID_AUTO, stats_reset,
+    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+    dma_fence_stats_sysctl_reset, "I", "Clear fence context statistics");
+
+static int
+dma_fence_stats_sysctl_dropped(SYSCTL_HANDLER_ARGS)
+{
+	uint64_t val;
+
+	val = atomic64_read(&dma_fence_stats_dropped);
+	return (sysctl_handle_64(oidp, &val, 0, req));
+}
+SYSCTL_PROC(_compat_linuxkpi_dma_fence, OID_AUTO, stats_dropped,
+    CTLTYPE_U64 | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+    dma_fence_stats_sysctl_dropped, "QU",
+    "Signaled fences whose context did not fit the statistics table");
+
+static void
+dma_fence_stats_print_hist(struct sbuf *sb, const char *name,
+    atomic64_t *hist)
+{
+	unsigned int i;
+
+	sbuf_printf(sb, "  %-7s", name);
+	for (i = 0; i < DMA_FENCE_STATS_BUCKETS; i++)
+		sbuf_printf(sb, " %ju", (uintmax_t)atomic64_read(&hist[i]));
+	sbuf_printf(sb, "\n");
+}
+
+static int
+dma_fence_stats_sysctl_contexts(SYSCTL_HANDLER_ARGS)
+{
+	struct dma_fence_ctx_stats *st, *table;
+	struct sbuf sb;
+	unsigned int i;
+	int error;
+
+	error = sysctl_wire_old_buffer(req, 0);
+	if (error != 0)
+		return (error);
+
+	sbuf_new_for_sysctl(&sb, NULL, 128, req);
+	sbuf_printf(&sb, "\n%-10s %-16s %-32s %10s %10s %6s\n", "context",
+	    "driver", "timeline", "signaled", "callbacks", "maxcb");
+	sbuf_printf(&sb, "  histograms: bucket n counts latencies "
+	    "in [2^(n-1), 2^n) us\n");
+	table = READ_ONCE(dma_fence_stats);
+	for (i = 0; table != NULL && i < DMA_FENCE_STATS_CONTEXTS; i++) {
+		st = &table[i];
+		if (atomic64_read(&st->context) == 0)
+			continue;
+		sbuf_printf(&sb, "%-10ju %-16.16s %-32.32s %10ju %10ju %6d\n",
+		    (uintmax_t)atomic64_read(&st->context), st->driver,
+		    st->timeline, (uintmax_t)atomic64_read(&st->signaled),
+		    (uintmax_t)atomic64_read(&st->callbacks),
+		    atomic_read(&st->callbacks_max));
+		dma_fence_stats_print_hist(&sb, "init", st->signal_hist);
+		dma_fence_stats_print_hist(&sb, "enable", st->enable_hist);
+	}
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+
+	return (error);
+}
+SYSCTL_PROC(_compat_linuxkpi_dma_fence, OID_AUTO, contexts,
+    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+    dma_fence_stats_sysctl_contexts, "A",
+    "Per context signal counts and latency histograms");
+
+static void
+dma_fence_stats_uninit(void *arg __unused)
+{
+	free(dma_fence_stats, M_DMA_FENCE_STATS);
+}
+SYSUNINIT(dma_fence_stats, SI_SUB_DRIVERS, SI_ORDER_SECOND,
+    dma_fence_stats_uninit, NULL);
+#endif
+
 /*
  * fence context counter: each execution context should have its own
  * fence context, this allows checking if fences belong to the same
@@ -141,6 +423,10 @@ int dma_fence_signal_locked(struct dma_fence *fence)
 {
 	struct dma_fence_cb *cur, *tmp;
 	struct list_head cb_list;
+#ifdef __FreeBSD__
+	struct dma_fence_ctx_stats *stats;
+	unsigned int ncb = 0;
+#endif
 
 	lockdep_assert_held(fence->lock);
 
@@ -154,16 +440,48 @@ int dma_fence_signal_locked(struct dma_fence *fence)
 	fence->timestamp = ktime_get();
 	set_bit(DMA_FENCE_FLAG_TIMESTAMP_BIT, &fence->flags);
 	trace_dma_fence_signaled(fence);
+#ifdef __FreeBSD__
+	/* A callback may drop the last reference, sample the fence first. */
+	stats = dma_fence_stats_signal(fence);
+#endif
 
 	list_for_each_entry_safe(cur, tmp, &cb_list, node) {
 		INIT_LIST_HEAD(&cur->node);
 		cur->func(fence, cur);
+#ifdef __FreeBSD__
+		ncb++;
+#endif
 	}
+#ifdef __FreeBSD__
+	if (stats != NULL)
+		dma_fence_stats_callbacks(stats, ncb);
+#endif
 
 	return 0;
 }
 EXPORT_SYMBOL(dma_fence_signal_locked);
 
+#ifdef __FreeBSD__
+/**
+ * dma_fence_stats_signaled - record the signaling of a fence
+ * @fence: the fence being signaled
+ * @ncb: number of callbacks about to run
+ *
+ * For drivers which signal their fences without dma_fence_signal_locked(),
+ * like the i915 breadcrumbs. Must be called after the timestamp of @fence
+ * was set and before its callbacks run.
+ */
+void dma_fence_stats_signaled(struct dma_fence *fence, unsigned int ncb)
+{
+	struct dma_fence_ctx_stats *stats;
+
+	stats = dma_fence_stats_signal(fence);
+	if (stats != NULL)
+		dma_fence_stats_callbacks(stats, ncb);
+}
+EXPORT_SYMBOL(dma_fence_stats_signaled);
+#endif
+
 /**
  * dma_fence_signal - signal completion of a fence
  * @fence: the fence to signal
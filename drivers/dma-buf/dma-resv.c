@@ -78,11 +78,13 @@ static struct dma_resv_list *dma_resv_list_alloc(unsigned int shared_max)
 
 /**
  * dma_resv_list_free - free fence list
+ * @obj: reservation object the list belonged to, or NULL
  * @list: list to free
  *
- * Free a dma_resv_list and make sure to drop all references.
+ * Free a dma_resv_list and make sure to drop all references. The inline list
+ * of @obj only has its references dropped.
  */
-static void dma_resv_list_free(struct dma_resv_list *list)
+static void dma_resv_list_free(struct dma_resv *obj, struct dma_resv_list *list)
 {
 	unsigned int i;
 
@@ -92,7 +94,8 @@ static void dma_resv_list_free(struct dma_resv_list *list)
 	for (i = 0; i < list->shared_count; ++i)
 		dma_fence_put(rcu_dereference_protected(list->shared[i], true));
 
-	kfree_rcu(list, rcu);
+	if (obj == NULL || !dma_resv_list_is_inline(obj, list))
+		kfree_rcu(list, rcu);
 }
 
 /**
@@ -128,7 +131,7 @@ void dma_resv_fini(struct dma_resv *obj)
 		dma_fence_put(excl);
 
 	fobj = rcu_dereference_protected(obj->fence, 1);
-	dma_resv_list_free(fobj);
+	dma_resv_list_free(obj, fobj);
 	ww_mutex_destroy(&obj->lock);
 }
 EXPORT_SYMBOL(dma_resv_fini);
@@ -160,8 +163,19 @@ int dma_resv_reserve_shared(struct dma_resv *obj, unsigned int num_fences)
 		else
 			max = max(old->shared_count + num_fences,
 				  old->shared_max * 2);
+	} else if (num_fences <= DMA_RESV_INLINE_SHARED) {
+		/*
+		 * Start out with the inline list. Should it have been in use
+		 * before, readers still looking at it are caught by the
+		 * seqcount like for any other in place update.
+		 */
+		new = (struct dma_resv_list *)obj->fence_inline;
+		new->shared_count = 0;
+		new->shared_max = DMA_RESV_INLINE_SHARED;
+		rcu_assign_pointer(obj->fence, new);
+		return 0;
 	} else {
-		max = 4;
+		max = max_t(unsigned int, num_fences, 4);
 	}
 
 	new = dma_resv_list_alloc(max);
@@ -207,7 +221,8 @@ int dma_resv_reserve_shared(struct dma_resv *obj, unsigned int num_fences)
 						  dma_resv_held(obj));
 		dma_fence_put(fence);
 	}
-	kfree_rcu(old, rcu);
+	if (!dma_resv_list_is_inline(obj, old))
+		kfree_rcu(old, rcu);
 
 	return 0;
 }
@@ -219,13 +234,15 @@ EXPORT_SYMBOL(dma_resv_reserve_shared);
  * @fence: the shared fence to add
  *
  * Add a fence to a shared slot, obj->lock must be held, and
- * dma_resv_reserve_shared() has been called.
+ * dma_resv_reserve_shared() has been called. The fence of the same context
+ * this one replaces and all signaled fences are dropped from the list, which
+ * keeps the list short for objects shared by many contexts.
  */
 void dma_resv_add_shared_fence(struct dma_resv *obj, struct dma_fence *fence)
 {
 	struct dma_resv_list *fobj;
-	struct dma_fence *old;
-	unsigned int i, count;
+	struct dma_fence *old, *tmp;
+	unsigned int i, j, count;
 
 	dma_fence_get(fence);
 
@@ -237,27 +254,44 @@ void dma_resv_add_shared_fence(struct dma_resv *obj, struct dma_fence *fence)
 	preempt_disable();
 	write_seqcount_begin(&obj->seq);
 
-	for (i = 0; i < count; ++i) {
-
+	/*
+	 * Move the fences to keep to the front, the dropped ones end up
+	 * behind them and are released once the new count is visible.
+	 */
+	for (i = 0, j = 0; i < count; ++i) {
 		old = rcu_dereference_protected(fobj->shared[i],
 						dma_resv_held(obj));
 		if (old->context == fence->context ||
 		    dma_fence_is_signaled(old))
-			goto replace;
+			continue;
+
+		if (i != j) {
+			tmp = rcu_dereference_protected(fobj->shared[j],
+							dma_resv_held(obj));
+			RCU_INIT_POINTER(fobj->shared[j], old);
+			RCU_INIT_POINTER(fobj->shared[i], tmp);
+		}
+		j++;
 	}
 
-	BUG_ON(fobj->shared_count >= fobj->shared_max);
-	old = NULL;
-	count++;
+	if (j == count) {
+		BUG_ON(fobj->shared_count >= fobj->shared_max);
+		old = NULL;
+	} else {
+		old = rcu_dereference_protected(fobj->shared[j],
+						dma_resv_held(obj));
+	}
 
-replace:
-	RCU_INIT_POINTER(fobj->shared[i], fence);
+	RCU_INIT_POINTER(fobj->shared[j], fence);
 	/* pointer update must be visible before we extend the shared_count */
-	smp_store_mb(fobj->shared_count, count);
+	smp_store_mb(fobj->shared_count, j + 1);
 
 	write_seqcount_end(&obj->seq);
 	preempt_enable();
 	dma_fence_put(old);
+	for (i = j + 1; i < count; ++i)
+		dma_fence_put(rcu_dereference_protected(fobj->shared[i],
+							dma_resv_held(obj)));
 }
 EXPORT_SYMBOL(dma_resv_add_shared_fence);
 
@@ -346,7 +380,7 @@ retry:
 				continue;
 
 			if (!dma_fence_get_rcu(fence)) {
-				dma_resv_list_free(dst_list);
+				dma_resv_list_free(NULL, dst_list);
 				src_list = rcu_dereference(src->fence);
 				goto retry;
 			}
@@ -376,7 +410,7 @@ retry:
 	write_seqcount_end(&dst->seq);
 	preempt_enable();
 
-	dma_resv_list_free(src_list);
+	dma_resv_list_free(dst, src_list);
 	dma_fence_put(old);
 
 	return 0;
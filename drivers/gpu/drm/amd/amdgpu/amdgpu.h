@@ -943,6 +943,9 @@ struct amdgpu_device {
 
 	/* firmwares */
 	struct amdgpu_firmware		firmware;
+#ifdef __FreeBSD__
+	struct firmware_batch		*firmware_prefetch;
+#endif
 
 	/* PSP */
 	struct psp_context		psp;
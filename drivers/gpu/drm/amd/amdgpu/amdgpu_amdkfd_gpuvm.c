@@ -266,7 +266,8 @@ static int amdgpu_amdkfd_remove_eviction_fence(struct amdgpu_bo *bo,
 					      dma_resv_held(resv));
 		dma_fence_put(f);
 	}
-	kfree_rcu(old, rcu);
+	if (!dma_resv_list_is_inline(resv, old))
+		kfree_rcu(old, rcu);
 
 	return 0;
 }
@@ -863,9 +863,9 @@ static int amdgpu_debugfs_test_ib(struct seq_file *m, void *data)
 	for (i = 0; i < AMDGPU_MAX_RINGS; i++) {
 		struct amdgpu_ring *ring = adev->rings[i];
 
-		if (!ring || !ring->sched.thread)
+		if (!ring || !drm_sched_has_worker(&ring->sched))
 			continue;
-		kthread_park(ring->sched.thread);
+		drm_sched_park(&ring->sched);
 	}
 
 	seq_printf(m, "run ib test:\n");
@@ -879,9 +879,9 @@ static int amdgpu_debugfs_test_ib(struct seq_file *m, void *data)
 	for (i = 0; i < AMDGPU_MAX_RINGS; i++) {
 		struct amdgpu_ring *ring = adev->rings[i];
 
-		if (!ring || !ring->sched.thread)
+		if (!ring || !drm_sched_has_worker(&ring->sched))
 			continue;
-		kthread_unpark(ring->sched.thread);
+		drm_sched_unpark(&ring->sched);
 	}
 
 	return 0;
@@ -1024,7 +1024,8 @@ static int amdgpu_debugfs_ib_preempt(void *data, u64 val)
 
 	ring = adev->rings[val];
 
-	if (!ring || !ring->funcs->preempt_ib || !ring->sched.thread)
+	if (!ring || !ring->funcs->preempt_ib ||
+	    !drm_sched_has_worker(&ring->sched))
 		return -EINVAL;
 
 	/* the last preemption failed */
@@ -1037,7 +1038,7 @@ static int amdgpu_debugfs_ib_preempt(void *data, u64 val)
 		return -ENOMEM;
 
 	/* stop the scheduler */
-	kthread_park(ring->sched.thread);
+	drm_sched_park(&ring->sched);
 
 	resched = ttm_bo_lock_delayed_workqueue(&adev->mman.bdev);
 
@@ -1073,7 +1074,7 @@ static int amdgpu_debugfs_ib_preempt(void *data, u64 val)
 
 failure:
 	/* restart the scheduler */
-	kthread_unpark(ring->sched.thread);
+	drm_sched_unpark(&ring->sched);
 
 	ttm_bo_unlock_delayed_workqueue(&adev->mman.bdev, resched);
 
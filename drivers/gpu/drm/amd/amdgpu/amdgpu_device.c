@@ -30,6 +30,7 @@
 #include <linux/module.h>
 #include <linux/console.h>
 #include <linux/slab.h>
+#include <linux/ctype.h>
 
 #include <drm/drm_atomic_helper.h>
 #include <drm/drm_probe_helper.h>
@@ -110,6 +111,49 @@ static const char *amdgpu_asic_name[] = {
 	"LAST",
 };
 
+#ifdef __FreeBSD__
+SET_DECLARE(linux_module_firmware, const char);
+
+/*
+ * Start loading every image declared with MODULE_FIRMWARE() for this ASIC
+ * in the background, so that the firmware kernel modules are linked in
+ * parallel instead of one at a time as each IP block's init_microcode asks
+ * for its images. The later request_firmware() calls are served from the
+ * linuxkpi firmware cache. The prefix also matches variants this device
+ * never asks for; those are dropped again once the batch is released and
+ * missing ones are not waited for.
+ */
+static void amdgpu_device_prefetch_firmware(struct amdgpu_device *adev)
+{
+	const char **names, **namep;
+	char prefix[32];
+	unsigned int count;
+	size_t len;
+	char *p;
+
+	len = snprintf(prefix, sizeof(prefix), "amdgpu/%s_",
+		       amdgpu_asic_name[adev->asic_type]);
+	for (p = prefix; *p != '\0'; p++)
+		*p = tolower(*p);
+
+	names = kmalloc_array(SET_COUNT(linux_module_firmware), sizeof(*names),
+			      GFP_KERNEL);
+	if (!names)
+		return;
+
+	count = 0;
+	SET_FOREACH(namep, linux_module_firmware) {
+		if (strncmp(*namep, prefix, len) == 0)
+			names[count++] = *namep;
+	}
+
+	/* The batch copies the names, only the array is ours. */
+	adev->firmware_prefetch = count ?
+		request_firmware_batch(names, count, adev->dev) : NULL;
+	kfree(names);
+}
+#endif
+
 /**
  * DOC: pcie_replay_count
  *
@@ -2732,18 +2776,22 @@ int amdgpu_device_init(struct amdgpu_device *adev,
 	if (amdgpu_mes && adev->asic_type >= CHIP_NAVI10)
 		adev->enable_mes = true;
 
+#ifdef __FreeBSD__
+	amdgpu_device_prefetch_firmware(adev);
+#endif
+
 	if (amdgpu_discovery && adev->asic_type >= CHIP_NAVI10) {
 		r = amdgpu_discovery_init(adev);
 		if (r) {
 			dev_err(adev->dev, "amdgpu_discovery_init failed\n");
-			return r;
+			goto prefetch_failed;
 		}
 	}
 
 	/* early init functions */
 	r = amdgpu_device_ip_early_init(adev);
 	if (r)
-		return r;
+		goto prefetch_failed;
 
 	/* doorbell bar mapping and doorbell index init*/
 	amdgpu_device_doorbell_init(adev);
@@ -2830,6 +2878,14 @@ fence_driver_init:
 	drm_mode_config_init(adev->ddev);
 
 	r = amdgpu_device_ip_init(adev);
+#ifdef __FreeBSD__
+	/*
+	 * Every IP block has requested its microcode by now, let the unused
+	 * images go. This does not wait for loads still in flight.
+	 */
+	firmware_batch_release(adev->firmware_prefetch);
+	adev->firmware_prefetch = NULL;
+#endif
 	if (r) {
 		/* failed in exclusive mode due to timeout */
 		if (amdgpu_sriov_vf(adev) &&
@@ -2948,6 +3004,11 @@ failed:
 	amdgpu_vf_error_trans_all(adev);
 	if (runtime)
 		vga_switcheroo_fini_domain_pm_ops(adev->dev);
+prefetch_failed:
+#ifdef __FreeBSD__
+	firmware_batch_release(adev->firmware_prefetch);
+	adev->firmware_prefetch = NULL;
+#endif
 
 	return r;
 }
@@ -3593,7 +3654,7 @@ static int amdgpu_device_pre_asic_reset(struct amdgpu_device *adev,
 	for (i = 0; i < AMDGPU_MAX_RINGS; ++i) {
 		struct amdgpu_ring *ring = adev->rings[i];
 
-		if (!ring || !ring->sched.thread)
+		if (!ring || !drm_sched_has_worker(&ring->sched))
 			continue;
 
 		/* after all hw jobs are reset, hw fence is meaningless, so force_completion */
@@ -3878,7 +3939,7 @@ int amdgpu_device_gpu_recover(struct amdgpu_device *adev,
 		for (i = 0; i < AMDGPU_MAX_RINGS; ++i) {
 			struct amdgpu_ring *ring = tmp_adev->rings[i];
 
-			if (!ring || !ring->sched.thread)
+			if (!ring || !drm_sched_has_worker(&ring->sched))
 				continue;
 
 			drm_sched_stop(&ring->sched, job ? &job->base : NULL);
@@ -3951,7 +4012,7 @@ skip_hw_reset:
 		for (i = 0; i < AMDGPU_MAX_RINGS; ++i) {
 			struct amdgpu_ring *ring = tmp_adev->rings[i];
 
-			if (!ring || !ring->sched.thread)
+			if (!ring || !drm_sched_has_worker(&ring->sched))
 				continue;
 
 			/* No point to resubmit jobs if we didn't HW reset*/
@@ -713,6 +713,14 @@ static int amdgpu_debugfs_fence_info(struct seq_file *m, void *data)
 			   atomic_read(&ring->fence_drv.last_seq));
 		seq_printf(m, "Last emitted                 0x%08x\n",
 			   ring->fence_drv.sync_seq);
+		seq_printf(m, "Scheduler busy (us)          %llu\n",
+			   div_u64(atomic64_read(&ring->sched.busy_time),
+				   NSEC_PER_USEC));
+		seq_printf(m, "Scheduler queued work (us)   %llu\n",
+			   div_u64(atomic64_read(&ring->sched.pending_cost),
+				   NSEC_PER_USEC));
+		seq_printf(m, "Scheduler queued jobs        %d\n",
+			   atomic_read(&ring->sched.num_jobs));
 
 		if (ring->funcs->type == AMDGPU_RING_TYPE_GFX ||
 		    ring->funcs->type == AMDGPU_RING_TYPE_SDMA) {
@@ -579,7 +579,18 @@ __poll_t drm_poll(struct file *filp, struct poll_table_struct *wait)
 	struct drm_file *file_priv = filp->private_data;
 	__poll_t mask = 0;
 
+#ifdef __linux__
 	poll_wait(filp, &file_priv->event_wait, wait);
+#elif defined(__FreeBSD__)
+	/*
+	 * drm_send_event_locked() posts new events straight to the file's
+	 * selinfo and knote list, so there is no need to hook the file up to
+	 * the event wait queue. Only select() needs recording, kqueue polls
+	 * with a NULL table to refresh the knote state.
+	 */
+	if (wait != NULL)
+		selrecord(curthread, &filp->f_selinfo);
+#endif
 
 	if (!list_empty(&file_priv->event_list))
 #ifdef __linux__
@@ -739,6 +750,15 @@ void drm_send_event_locked(struct drm_device *dev, struct drm_pending_event *e)
 	list_add_tail(&e->link,
 		      &e->file_priv->event_list);
 	wake_up_interruptible(&e->file_priv->event_wait);
+#ifdef __FreeBSD__
+	/*
+	 * Activate select() and kqueue waiters directly. The knote stays
+	 * active until drm_read() drains the event list, which gives level
+	 * triggered kevents, while EV_CLEAR ones fire once per event.
+	 */
+	if (e->file_priv->filp != NULL)
+		linux_poll_wakeup(e->file_priv->filp);
+#endif
 }
 EXPORT_SYMBOL(drm_send_event_locked);
 
@@ -49,6 +49,9 @@
 
 #include "drm_internal.h"
 
+/* Number of handles drm_gem_objects_lookup_array() copies in at once */
+#define DRM_GEM_LOOKUP_CHUNK	64
+
 /** @file drm_gem.c
  *
  * This file provides some of the base ioctls and library routines for
@@ -679,9 +682,66 @@ static int objects_lookup(struct drm_file *filp, u32 *handle, int count,
 	}
 	spin_unlock(&filp->table_lock);
 
+	if (ret) {
+		while (i--) {
+			drm_gem_object_put_unlocked(objs[i]);
+			objs[i] = NULL;
+		}
+	}
+
 	return ret;
 }
 
+/**
+ * drm_gem_objects_lookup_array - look up GEM objects from an array of handles
+ * @filp: DRM file private date
+ * @bo_handles: user pointer to array of userspace handle
+ * @count: size of handle array
+ * @objs: caller provided array of @count GEM object pointers to fill in
+ *
+ * Like drm_gem_objects_lookup(), but fills in an array provided by the caller,
+ * which can be embedded in or pooled with its job structure. The handles are
+ * copied in and resolved in fixed size chunks on the stack, so no memory is
+ * allocated.
+ *
+ * Returns:
+ *
+ * 0 on success, with @objs holding references that need to be released with
+ * drm_gem_object_put(). -ENOENT on a lookup failure or -EFAULT if the handles
+ * can't be read, in which case no references are held.
+ */
+int drm_gem_objects_lookup_array(struct drm_file *filp, void __user *bo_handles,
+				 int count, struct drm_gem_object **objs)
+{
+	u32 handles[DRM_GEM_LOOKUP_CHUNK];
+	u32 __user *uhandles = bo_handles;
+	int i, n, ret = 0;
+
+	for (i = 0; i < count; i += n) {
+		n = min(count - i, DRM_GEM_LOOKUP_CHUNK);
+
+		if (copy_from_user(handles, uhandles + i, n * sizeof(u32))) {
+			ret = -EFAULT;
+			DRM_DEBUG("Failed to copy in GEM handles\n");
+			break;
+		}
+
+		ret = objects_lookup(filp, handles, n, &objs[i]);
+		if (ret)
+			break;
+	}
+
+	if (ret) {
+		while (i--) {
+			drm_gem_object_put_unlocked(objs[i]);
+			objs[i] = NULL;
+		}
+	}
+
+	return ret;
+}
+EXPORT_SYMBOL(drm_gem_objects_lookup_array);
+
 /**
  * drm_gem_objects_lookup - look up GEM objects from an array of handles
  * @filp: DRM file private date
@@ -692,7 +752,8 @@ static int objects_lookup(struct drm_file *filp, u32 *handle, int count,
  * Takes an array of userspace handles and returns a newly allocated array of
  * GEM objects.
  *
- * For a single handle lookup, use drm_gem_object_lookup().
+ * For a single handle lookup, use drm_gem_object_lookup(). To avoid the
+ * allocation, use drm_gem_objects_lookup_array().
  *
  * Returns:
  *
@@ -704,8 +765,6 @@ static int objects_lookup(struct drm_file *filp, u32 *handle, int count,
 int drm_gem_objects_lookup(struct drm_file *filp, void __user *bo_handles,
 			   int count, struct drm_gem_object ***objs_out)
 {
-	int ret;
-	u32 *handles;
 	struct drm_gem_object **objs;
 
 	if (!count)
@@ -716,25 +775,9 @@ int drm_gem_objects_lookup(struct drm_file *filp, void __user *bo_handles,
 	if (!objs)
 		return -ENOMEM;
 
-	handles = kvmalloc_array(count, sizeof(u32), GFP_KERNEL);
-	if (!handles) {
-		ret = -ENOMEM;
-		goto out;
-	}
-
-	if (copy_from_user(handles, bo_handles, count * sizeof(u32))) {
-		ret = -EFAULT;
-		DRM_DEBUG("Failed to copy in GEM handles\n");
-		goto out;
-	}
-
-	ret = objects_lookup(filp, handles, count, objs);
 	*objs_out = objs;
 
-out:
-	kvfree(handles);
-	return ret;
-
+	return drm_gem_objects_lookup_array(filp, bo_handles, count, objs);
 }
 EXPORT_SYMBOL(drm_gem_objects_lookup);
 
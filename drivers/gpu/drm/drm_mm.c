@@ -44,8 +44,10 @@
 
 #include <linux/export.h>
 #include <linux/interval_tree_generic.h>
+#include <linux/ktime.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
 #include <linux/stacktrace.h>
 
 #include <drm/drm_mm.h>
@@ -144,9 +146,15 @@ static void show_leaks(struct drm_mm *mm)
 
 #undef STACKDEPTH
 #undef BUFSZ
+
+static inline u64 stats_clock(void)
+{
+	return ktime_get_raw_ns();
+}
 #else
 static void save_stack(struct drm_mm_node *node) { }
 static void show_leaks(struct drm_mm *mm) { }
+static inline u64 stats_clock(void) { return 0; }
 #endif
 
 #define START(node) ((node)->start)
@@ -258,6 +266,87 @@ static void insert_hole_size(struct rb_root_cached *root,
 	rb_insert_color_cached(&node->rb_hole_size, root, first);
 }
 
+/*
+ * Optional segregated-fit index over the holes, in the style of TLSF: hole
+ * sizes are split into power-of-two classes, each of which is split again into
+ * DRM_MM_CLASS_SL linear sub-classes, so a hole from a class that is known to
+ * be large enough is at most an eighth larger than the request. Sizes below
+ * DRM_MM_CLASS_SL get a class each in the first row. The two bitmaps track
+ * which lists are non-empty, so the first suitable list is found in constant
+ * time.
+ */
+#define DRM_MM_CLASS_SL_SHIFT 3
+#define DRM_MM_CLASS_SL BIT(DRM_MM_CLASS_SL_SHIFT)
+#define DRM_MM_CLASS_FL (64 - DRM_MM_CLASS_SL_SHIFT + 1)
+
+struct drm_mm_hole_classes {
+	u64 fl_map;
+	u8 sl_map[DRM_MM_CLASS_FL];
+	struct list_head lists[DRM_MM_CLASS_FL][DRM_MM_CLASS_SL];
+};
+
+static void hole_class(u64 size, unsigned int *fl, unsigned int *sl)
+{
+	unsigned int shift;
+
+	if (size < DRM_MM_CLASS_SL) {
+		*fl = 0;
+		*sl = size;
+		return;
+	}
+
+	shift = fls64(size) - 1 - DRM_MM_CLASS_SL_SHIFT;
+	*fl = shift + 1;
+	*sl = (size >> shift) & (DRM_MM_CLASS_SL - 1);
+}
+
+/* Find the first non-empty class at or after (@fl, @sl). */
+static bool next_hole_class(const struct drm_mm_hole_classes *classes,
+			    unsigned int *fl, unsigned int *sl)
+{
+	unsigned int sl_map = classes->sl_map[*fl] & (0xff << *sl);
+
+	if (!sl_map) {
+		u64 fl_map = 0;
+
+		if (*fl + 1 < DRM_MM_CLASS_FL)
+			fl_map = classes->fl_map & (~0ULL << (*fl + 1));
+		if (!fl_map)
+			return false;
+
+		*fl = __ffs64(fl_map);
+		sl_map = classes->sl_map[*fl];
+	}
+
+	*sl = __ffs(sl_map);
+	return true;
+}
+
+static void add_hole_class(struct drm_mm *mm, struct drm_mm_node *node)
+{
+	struct drm_mm_hole_classes *classes = mm->hole_classes;
+	unsigned int fl, sl;
+
+	hole_class(node->hole_size, &fl, &sl);
+	list_add(&node->hole_class, &classes->lists[fl][sl]);
+	classes->sl_map[fl] |= BIT(sl);
+	classes->fl_map |= BIT_ULL(fl);
+}
+
+static void rm_hole_class(struct drm_mm *mm, struct drm_mm_node *node)
+{
+	struct drm_mm_hole_classes *classes = mm->hole_classes;
+	unsigned int fl, sl;
+
+	hole_class(node->hole_size, &fl, &sl);
+	list_del(&node->hole_class);
+	if (list_empty(&classes->lists[fl][sl])) {
+		classes->sl_map[fl] &= ~BIT(sl);
+		if (!classes->sl_map[fl])
+			classes->fl_map &= ~BIT_ULL(fl);
+	}
+}
+
 static void add_hole(struct drm_mm_node *node)
 {
 	struct drm_mm *mm = node->mm;
@@ -270,15 +359,21 @@ static void add_hole(struct drm_mm_node *node)
 	RB_INSERT(mm->holes_addr, rb_hole_addr, HOLE_ADDR);
 
 	list_add(&node->hole_stack, &mm->hole_stack);
+	if (mm->hole_classes)
+		add_hole_class(mm, node);
 }
 
 static void rm_hole(struct drm_mm_node *node)
 {
+	struct drm_mm *mm = node->mm;
+
 	DRM_MM_BUG_ON(!drm_mm_hole_follows(node));
 
+	if (mm->hole_classes)
+		rm_hole_class(mm, node);
 	list_del(&node->hole_stack);
-	rb_erase_cached(&node->rb_hole_size, &node->mm->holes_size);
-	rb_erase(&node->rb_hole_addr, &node->mm->holes_addr);
+	rb_erase_cached(&node->rb_hole_size, &mm->holes_size);
+	rb_erase(&node->rb_hole_addr, &mm->holes_addr);
 	node->hole_size = 0;
 
 	DRM_MM_BUG_ON(drm_mm_hole_follows(node));
@@ -438,6 +533,7 @@ int drm_mm_reserve_node(struct drm_mm *mm, struct drm_mm_node *node)
 	if (end < hole_end)
 		add_hole(node);
 
+	mm->stats.reserve++;
 	save_stack(node);
 	return 0;
 }
@@ -448,6 +544,158 @@ static u64 rb_to_hole_size_or_zero(struct rb_node *rb)
 	return rb ? rb_to_hole_size(rb) : 0;
 }
 
+/*
+ * Check whether a node of @size fits into @hole, after the hole has been
+ * trimmed by color_adjust and clamped to the range, and return where it would
+ * start in @start.
+ */
+static bool hole_fits(struct drm_mm *mm, struct drm_mm_node *hole,
+		      u64 size, u64 alignment, u64 remainder_mask,
+		      unsigned long color, u64 range_start, u64 range_end,
+		      enum drm_mm_insert_mode mode, u64 *start)
+{
+	u64 hole_start = __drm_mm_hole_node_start(hole);
+	u64 hole_end = hole_start + hole->hole_size;
+	u64 adj_start, adj_end;
+	u64 col_start, col_end;
+
+	col_start = hole_start;
+	col_end = hole_end;
+	if (mm->color_adjust)
+		mm->color_adjust(hole, color, &col_start, &col_end);
+
+	adj_start = max(col_start, range_start);
+	adj_end = min(col_end, range_end);
+
+	if (adj_end <= adj_start || adj_end - adj_start < size)
+		return false;
+
+	if (mode == DRM_MM_INSERT_HIGH)
+		adj_start = adj_end - size;
+
+	if (alignment) {
+		u64 rem;
+
+		if (likely(remainder_mask))
+			rem = adj_start & remainder_mask;
+		else
+			div64_u64_rem(adj_start, alignment, &rem);
+		if (rem) {
+			adj_start -= rem;
+			if (mode != DRM_MM_INSERT_HIGH)
+				adj_start += alignment;
+
+			if (adj_start < max(col_start, range_start) ||
+			    min(col_end, range_end) - adj_start < size)
+				return false;
+
+			if (adj_end <= adj_start ||
+			    adj_end - adj_start < size)
+				return false;
+		}
+	}
+
+	*start = adj_start;
+	return true;
+}
+
+static void insert_into_hole(struct drm_mm *mm, struct drm_mm_node *hole,
+			     struct drm_mm_node *node, u64 size,
+			     unsigned long color, u64 start)
+{
+	u64 hole_start = __drm_mm_hole_node_start(hole);
+	u64 hole_end = hole_start + hole->hole_size;
+
+	node->mm = mm;
+	node->size = size;
+	node->start = start;
+	node->color = color;
+	node->hole_size = 0;
+
+	list_add(&node->node_list, &hole->node_list);
+	drm_mm_interval_tree_add_node(hole, node);
+	node->allocated = true;
+
+	rm_hole(hole);
+	if (start > hole_start)
+		add_hole(hole);
+	if (start + size < hole_end)
+		add_hole(node);
+}
+
+/* Holes tried from the size class index before falling back to the trees. */
+#define DRM_MM_CLASS_SCAN 8
+
+/*
+ * Segregated fit: round @size up to the next class boundary, so that every
+ * hole in the resulting class and above is large enough, and take the first
+ * suitable hole from there instead of searching the size tree for the best
+ * fit. Only a few holes are tried, so that placements the index cannot serve
+ * quickly (restricted ranges, large alignments, colouring) fall back to the
+ * full search.
+ */
+static struct drm_mm_node *class_hole(struct drm_mm *mm, u64 size,
+				      u64 alignment, u64 remainder_mask,
+				      unsigned long color,
+				      u64 range_start, u64 range_end,
+				      u64 *start)
+{
+	struct drm_mm_hole_classes *classes = mm->hole_classes;
+	unsigned int budget = DRM_MM_CLASS_SCAN;
+	struct drm_mm_node *hole;
+	u64 class_size = size;
+	unsigned int fl, sl;
+
+	if (size >= DRM_MM_CLASS_SL) {
+		u64 round = BIT_ULL(fls64(size) - 1 - DRM_MM_CLASS_SL_SHIFT) - 1;
+
+		/*
+		 * Holes in the class of @size itself may or may not be large
+		 * enough. Try the first one so that exact fits are not left
+		 * behind, then move on to the classes that always fit.
+		 */
+		hole_class(size, &fl, &sl);
+		hole = list_first_entry_or_null(&classes->lists[fl][sl],
+						struct drm_mm_node, hole_class);
+		if (hole) {
+			mm->stats.insert_holes++;
+			budget--;
+
+			if (hole_fits(mm, hole, size, alignment, remainder_mask,
+				      color, range_start, range_end,
+				      DRM_MM_INSERT_BEST, start))
+				return hole;
+		}
+
+		if (size + round < size)
+			return NULL;
+		class_size += round;
+	}
+	hole_class(class_size, &fl, &sl);
+
+	while (next_hole_class(classes, &fl, &sl)) {
+		list_for_each_entry(hole, &classes->lists[fl][sl], hole_class) {
+			mm->stats.insert_holes++;
+
+			if (hole_fits(mm, hole, size, alignment, remainder_mask,
+				      color, range_start, range_end,
+				      DRM_MM_INSERT_BEST, start))
+				return hole;
+
+			if (!--budget)
+				return NULL;
+		}
+
+		if (++sl == DRM_MM_CLASS_SL) {
+			sl = 0;
+			if (++fl == DRM_MM_CLASS_FL)
+				break;
+		}
+	}
+
+	return NULL;
+}
+
 /**
  * drm_mm_insert_node_in_range - ranged search for space and insert @node
  * @mm: drm_mm to allocate from
@@ -473,15 +721,20 @@ int drm_mm_insert_node_in_range(struct drm_mm * const mm,
 {
 	struct drm_mm_node *hole;
 	u64 remainder_mask;
+	u64 adj_start;
+	u64 t0;
 	bool once;
 
 	DRM_MM_BUG_ON(range_start > range_end);
 
 	if (unlikely(size == 0 || range_end - range_start < size))
-		return -ENOSPC;
+		goto err_nospc;
 
 	if (rb_to_hole_size_or_zero(rb_first_cached(&mm->holes_size)) < size)
-		return -ENOSPC;
+		goto err_nospc;
+
+	mm->stats.insert_search++;
+	t0 = stats_clock();
 
 	if (alignment <= 1)
 		alignment = 0;
@@ -490,13 +743,23 @@ int drm_mm_insert_node_in_range(struct drm_mm * const mm,
 	mode &= ~DRM_MM_INSERT_ONCE;
 
 	remainder_mask = is_power_of_2(alignment) ? alignment - 1 : 0;
+
+	if (mode == DRM_MM_INSERT_BEST && !once && mm->hole_classes) {
+		hole = class_hole(mm, size, alignment, remainder_mask, color,
+				  range_start, range_end, &adj_start);
+		if (hole) {
+			mm->stats.insert_class++;
+			goto insert;
+		}
+	}
+
 	for (hole = first_hole(mm, range_start, range_end, size, mode);
 	     hole;
 	     hole = once ? NULL : next_hole(mm, hole, mode)) {
 		u64 hole_start = __drm_mm_hole_node_start(hole);
 		u64 hole_end = hole_start + hole->hole_size;
-		u64 adj_start, adj_end;
-		u64 col_start, col_end;
+
+		mm->stats.insert_holes++;
 
 		if (mode == DRM_MM_INSERT_LOW && hole_start >= range_end)
 			break;
@@ -504,63 +767,23 @@ int drm_mm_insert_node_in_range(struct drm_mm * const mm,
 		if (mode == DRM_MM_INSERT_HIGH && hole_end <= range_start)
 			break;
 
-		col_start = hole_start;
-		col_end = hole_end;
-		if (mm->color_adjust)
-			mm->color_adjust(hole, color, &col_start, &col_end);
-
-		adj_start = max(col_start, range_start);
-		adj_end = min(col_end, range_end);
-
-		if (adj_end <= adj_start || adj_end - adj_start < size)
-			continue;
-
-		if (mode == DRM_MM_INSERT_HIGH)
-			adj_start = adj_end - size;
-
-		if (alignment) {
-			u64 rem;
-
-			if (likely(remainder_mask))
-				rem = adj_start & remainder_mask;
-			else
-				div64_u64_rem(adj_start, alignment, &rem);
-			if (rem) {
-				adj_start -= rem;
-				if (mode != DRM_MM_INSERT_HIGH)
-					adj_start += alignment;
-
-				if (adj_start < max(col_start, range_start) ||
-				    min(col_end, range_end) - adj_start < size)
-					continue;
-
-				if (adj_end <= adj_start ||
-				    adj_end - adj_start < size)
-					continue;
-			}
-		}
-
-		node->mm = mm;
-		node->size = size;
-		node->start = adj_start;
-		node->color = color;
-		node->hole_size = 0;
-
-		list_add(&node->node_list, &hole->node_list);
-		drm_mm_interval_tree_add_node(hole, node);
-		node->allocated = true;
-
-		rm_hole(hole);
-		if (adj_start > hole_start)
-			add_hole(hole);
-		if (adj_start + size < hole_end)
-			add_hole(node);
-
-		save_stack(node);
-		return 0;
+		if (hole_fits(mm, hole, size, alignment, remainder_mask, color,
+			      range_start, range_end, mode, &adj_start))
+			goto insert;
 	}
 
+	mm->stats.insert_ns += stats_clock() - t0;
+err_nospc:
+	mm->stats.insert_fail++;
 	return -ENOSPC;
+
+insert:
+	insert_into_hole(mm, hole, node, size, color, adj_start);
+
+	mm->stats.insert++;
+	mm->stats.insert_ns += stats_clock() - t0;
+	save_stack(node);
+	return 0;
 }
 EXPORT_SYMBOL(drm_mm_insert_node_in_range);
 
@@ -576,10 +799,12 @@ void drm_mm_remove_node(struct drm_mm_node *node)
 {
 	struct drm_mm *mm = node->mm;
 	struct drm_mm_node *prev_node;
+	u64 t0;
 
 	DRM_MM_BUG_ON(!node->allocated);
 	DRM_MM_BUG_ON(node->scanned_block);
 
+	t0 = stats_clock();
 	prev_node = list_prev_entry(node, node_list);
 
 	if (drm_mm_hole_follows(node))
@@ -592,6 +817,9 @@ void drm_mm_remove_node(struct drm_mm_node *node)
 	if (drm_mm_hole_follows(prev_node))
 		rm_hole(prev_node);
 	add_hole(prev_node);
+
+	mm->stats.remove++;
+	mm->stats.remove_ns += stats_clock() - t0;
 }
 EXPORT_SYMBOL(drm_mm_remove_node);
 
@@ -617,6 +845,8 @@ void drm_mm_replace_node(struct drm_mm_node *old, struct drm_mm_node *new)
 
 	if (drm_mm_hole_follows(old)) {
 		list_replace(&old->hole_stack, &new->hole_stack);
+		if (mm->hole_classes)
+			list_replace(&old->hole_class, &new->hole_class);
 		rb_replace_node_cached(&old->rb_hole_size,
 				       &new->rb_hole_size,
 				       &mm->holes_size);
@@ -660,6 +890,12 @@ EXPORT_SYMBOL(drm_mm_replace_node);
  * O(scanned_objects). So like the free stack which needs to be walked before a
  * scan operation even begins this is linear in the number of objects. It
  * doesn't seem to hurt too badly.
+ *
+ * The roster evicts in the order objects are offered, which for large holes
+ * tends to evict more than needed. Drivers that can enumerate all eviction
+ * candidates up front may instead hand them over in one batch, each with an
+ * eviction cost, to drm_mm_scan_batch(), which picks the cheapest set of
+ * neighbouring candidates that opens up a suitable hole.
  */
 
 /**
@@ -713,41 +949,15 @@ void drm_mm_scan_init_with_range(struct drm_mm_scan *scan,
 }
 EXPORT_SYMBOL(drm_mm_scan_init_with_range);
 
-/**
- * drm_mm_scan_add_block - add a node to the scan list
- * @scan: the active drm_mm scanner
- * @node: drm_mm_node to add
- *
- * Add a node to the scan list that might be freed to make space for the desired
- * hole.
- *
- * Returns:
- * True if a hole has been found, false otherwise.
- */
-bool drm_mm_scan_add_block(struct drm_mm_scan *scan,
-			   struct drm_mm_node *node)
+static bool scan_hole_fits(const struct drm_mm_scan *scan,
+			   struct drm_mm_node *hole,
+			   u64 *hit_start)
 {
 	struct drm_mm *mm = scan->mm;
-	struct drm_mm_node *hole;
 	u64 hole_start, hole_end;
 	u64 col_start, col_end;
 	u64 adj_start, adj_end;
 
-	DRM_MM_BUG_ON(node->mm != mm);
-	DRM_MM_BUG_ON(!node->allocated);
-	DRM_MM_BUG_ON(node->scanned_block);
-	node->scanned_block = true;
-	mm->scan_active++;
-
-	/* Remove this block from the node_list so that we enlarge the hole
-	 * (distance between the end of our previous node and the start of
-	 * or next), without poisoning the link so that we can restore it
-	 * later in drm_mm_scan_remove_block().
-	 */
-	hole = list_prev_entry(node, node_list);
-	DRM_MM_BUG_ON(list_next_entry(hole, node_list) != node);
-	__list_del_entry(&node->node_list);
-
 	hole_start = __drm_mm_hole_node_start(hole);
 	hole_end = __drm_mm_hole_node_end(hole);
 
@@ -785,12 +995,54 @@ bool drm_mm_scan_add_block(struct drm_mm_scan *scan,
 		}
 	}
 
-	scan->hit_start = adj_start;
-	scan->hit_end = adj_start + scan->size;
+	DRM_MM_BUG_ON(adj_start < hole_start);
+	DRM_MM_BUG_ON(adj_start + scan->size > hole_end);
+
+	*hit_start = adj_start;
+	return true;
+}
+
+/**
+ * drm_mm_scan_add_block - add a node to the scan list
+ * @scan: the active drm_mm scanner
+ * @node: drm_mm_node to add
+ *
+ * Add a node to the scan list that might be freed to make space for the desired
+ * hole.
+ *
+ * Returns:
+ * True if a hole has been found, false otherwise.
+ */
+bool drm_mm_scan_add_block(struct drm_mm_scan *scan,
+			   struct drm_mm_node *node)
+{
+	struct drm_mm *mm = scan->mm;
+	struct drm_mm_node *hole;
+	u64 hit_start;
+
+	DRM_MM_BUG_ON(node->mm != mm);
+	DRM_MM_BUG_ON(!node->allocated);
+	DRM_MM_BUG_ON(node->scanned_block);
+	node->scanned_block = true;
+	mm->scan_active++;
+	mm->stats.scan_add++;
+
+	/* Remove this block from the node_list so that we enlarge the hole
+	 * (distance between the end of our previous node and the start of
+	 * or next), without poisoning the link so that we can restore it
+	 * later in drm_mm_scan_remove_block().
+	 */
+	hole = list_prev_entry(node, node_list);
+	DRM_MM_BUG_ON(list_next_entry(hole, node_list) != node);
+	__list_del_entry(&node->node_list);
+
+	if (!scan_hole_fits(scan, hole, &hit_start))
+		return false;
+
+	scan->hit_start = hit_start;
+	scan->hit_end = hit_start + scan->size;
 
 	DRM_MM_BUG_ON(scan->hit_start >= scan->hit_end);
-	DRM_MM_BUG_ON(scan->hit_start < hole_start);
-	DRM_MM_BUG_ON(scan->hit_end > hole_end);
 
 	return true;
 }
@@ -840,11 +1092,156 @@ bool drm_mm_scan_remove_block(struct drm_mm_scan *scan,
 		      list_next_entry(node, node_list));
 	list_add(&node->node_list, &prev_node->node_list);
 
-	return (node->start + node->size > scan->hit_start &&
-		node->start < scan->hit_end);
+	if (node->start + node->size > scan->hit_start &&
+	    node->start < scan->hit_end) {
+		node->mm->stats.scan_evict++;
+		return true;
+	}
+
+	return false;
 }
 EXPORT_SYMBOL(drm_mm_scan_remove_block);
 
+/*
+ * Check whether evicting the address ordered candidates @first to @last, and
+ * hence every node between them, would open up a suitable hole. The nodes are
+ * unlinked only for the duration of the check, so that color_adjust sees the
+ * neighbours the hole would have.
+ */
+static bool scan_window_fits(const struct drm_mm_scan *scan,
+			     const struct drm_mm_scan_candidate *first,
+			     const struct drm_mm_scan_candidate *last,
+			     u64 *hit_start)
+{
+	struct drm_mm_node *prev = list_prev_entry(first->node, node_list);
+	struct drm_mm_node *next = list_next_entry(last->node, node_list);
+	struct list_head *prev_next = prev->node_list.next;
+	struct list_head *next_prev = next->node_list.prev;
+	bool fits;
+
+	prev->node_list.next = &next->node_list;
+	next->node_list.prev = &prev->node_list;
+
+	fits = scan_hole_fits(scan, prev, hit_start);
+
+	prev->node_list.next = prev_next;
+	next->node_list.prev = next_prev;
+
+	return fits;
+}
+
+static int scan_candidate_cmp(const void *a, const void *b)
+{
+	const struct drm_mm_scan_candidate *ca = a, *cb = b;
+
+	if (ca->node->start < cb->node->start)
+		return -1;
+
+	return ca->node->start > cb->node->start;
+}
+
+/**
+ * drm_mm_scan_batch - find the cheapest eviction window in a batch of nodes
+ * @scan: drm_mm scan, set up with drm_mm_scan_init_with_range()
+ * @candidates: array of evictable nodes and their eviction cost
+ * @count: number of entries in @candidates
+ * @first: returns the index of the first node to evict
+ *
+ * This is an alternative to the one-at-a-time lru scan roster: rather than
+ * evicting nodes in the order they are offered until a suitable hole appears,
+ * the driver passes all its eviction candidates at once, each with a cost of
+ * evicting it (typically derived from its size, whether it is busy and how
+ * often it is used). Nodes that may not be evicted must simply be left out.
+ *
+ * @candidates is sorted by address, and the cheapest run of candidates whose
+ * eviction opens up a hole satisfying the size, alignment, color and range of
+ * @scan is returned as @candidates[@first] onwards. Only runs of candidates
+ * which are neighbours in the allocator are considered, and each run is
+ * searched with a sliding window, so the whole operation is O(count log count)
+ * for the sort plus O(count) window checks.
+ *
+ * The allocator is left untouched, and no drm_mm_scan_remove_block() calls are
+ * required. The driver then frees the selected nodes followed by any nodes
+ * reported by drm_mm_scan_color_evict(), after which the hole can be allocated
+ * with DRM_MM_INSERT_EVICT.
+ *
+ * Returns:
+ * The number of nodes to evict, or -ENOSPC if no window of candidates is large
+ * enough.
+ */
+int drm_mm_scan_batch(struct drm_mm_scan *scan,
+		      struct drm_mm_scan_candidate *candidates,
+		      unsigned int count,
+		      unsigned int *first)
+{
+	struct drm_mm *mm = scan->mm;
+	u64 best_cost = U64_MAX;
+	u64 best_start = 0;
+	int best = -ENOSPC;
+	unsigned int run, end, i, j;
+
+	DRM_MM_BUG_ON(mm->scan_active);
+
+	sort(candidates, count, sizeof(*candidates), scan_candidate_cmp, NULL);
+	mm->stats.scan_add += count;
+
+	for (run = 0; run < count; run = end) {
+		u64 cost = 0, hit_start = 0;
+		bool fits = false;
+
+		/* Gather the candidates that are neighbours in the allocator */
+		for (end = run + 1; end < count; end++) {
+			DRM_MM_BUG_ON(candidates[end].node->mm != mm);
+			DRM_MM_BUG_ON(!candidates[end].node->allocated);
+			if (list_next_entry(candidates[end - 1].node, node_list) !=
+			    candidates[end].node)
+				break;
+		}
+
+		/*
+		 * Slide a window [i, j) over the run: grow it until it fits,
+		 * then shrink it from the front. Dropping a node from the
+		 * front can only shrink the hole, so j never moves back.
+		 */
+		for (i = run, j = run; i < end; i++) {
+			while (!fits && j < end) {
+				cost += candidates[j].cost;
+				fits = scan_window_fits(scan,
+							&candidates[i],
+							&candidates[j],
+							&hit_start);
+				j++;
+			}
+			if (!fits)
+				break;
+
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_start = hit_start;
+				best = j - i;
+				*first = i;
+			}
+
+			cost -= candidates[i].cost;
+			fits = i + 1 < j &&
+				scan_window_fits(scan,
+						 &candidates[i + 1],
+						 &candidates[j - 1],
+						 &hit_start);
+		}
+	}
+
+	if (best < 0)
+		return best;
+
+	scan->hit_start = best_start;
+	scan->hit_end = best_start + scan->size;
+	mm->stats.scan_evict += best;
+
+	return best;
+}
+EXPORT_SYMBOL(drm_mm_scan_batch);
+
 /**
  * drm_mm_scan_color_evict - evict overlapping nodes on either side of hole
  * @scan: drm_mm scan with target hole
@@ -917,6 +1314,7 @@ void drm_mm_init(struct drm_mm *mm, u64 start, u64 size)
 	mm->interval_tree = RB_ROOT_CACHED;
 	mm->holes_size = RB_ROOT_CACHED;
 	mm->holes_addr = RB_ROOT;
+	mm->hole_classes = NULL;
 
 	/* Clever trick to avoid a special case in the free hole tracking. */
 	INIT_LIST_HEAD(&mm->head_node.node_list);
@@ -927,9 +1325,55 @@ void drm_mm_init(struct drm_mm *mm, u64 start, u64 size)
 	add_hole(&mm->head_node);
 
 	mm->scan_active = 0;
+	memset(&mm->stats, 0, sizeof(mm->stats));
 }
 EXPORT_SYMBOL(drm_mm_init);
 
+/**
+ * drm_mm_enable_size_classes - add a segregated-fit index to an allocator
+ * @mm: drm_mm allocator to add the index to
+ *
+ * Additionally keeps the holes of @mm on size class lists, one per eighth of
+ * each power of two. DRM_MM_INSERT_BEST then first tries a few holes from the
+ * smallest size class that is guaranteed to be large enough, which replaces
+ * the walk down the size tree for the common case, and only falls back to the
+ * best fit search if none of them fits. This trades a little fragmentation
+ * for cheaper inserts; tools/drm_mm_bench can be used to measure both for a
+ * given workload.
+ *
+ * May be called at any time after drm_mm_init(), but not while a scan is
+ * active.
+ *
+ * Returns:
+ * 0 on success, -ENOMEM if the class lists could not be allocated.
+ */
+int drm_mm_enable_size_classes(struct drm_mm *mm)
+{
+	struct drm_mm_hole_classes *classes;
+	struct drm_mm_node *hole;
+	unsigned int fl, sl;
+
+	DRM_MM_BUG_ON(mm->scan_active);
+
+	if (mm->hole_classes)
+		return 0;
+
+	classes = kzalloc(sizeof(*classes), GFP_KERNEL);
+	if (!classes)
+		return -ENOMEM;
+
+	for (fl = 0; fl < DRM_MM_CLASS_FL; fl++)
+		for (sl = 0; sl < DRM_MM_CLASS_SL; sl++)
+			INIT_LIST_HEAD(&classes->lists[fl][sl]);
+	mm->hole_classes = classes;
+
+	list_for_each_entry(hole, &mm->hole_stack, hole_stack)
+		add_hole_class(mm, hole);
+
+	return 0;
+}
+EXPORT_SYMBOL(drm_mm_enable_size_classes);
+
 /**
  * drm_mm_takedown - clean up a drm_mm allocator
  * @mm: drm_mm allocator to clean up
@@ -942,6 +1386,9 @@ void drm_mm_takedown(struct drm_mm *mm)
 	if (WARN(!drm_mm_clean(mm),
 		 "Memory manager not clean during takedown.\n"))
 		show_leaks(mm);
+
+	kfree(mm->hole_classes);
+	mm->hole_classes = NULL;
 }
 EXPORT_SYMBOL(drm_mm_takedown);
 
@@ -980,5 +1427,79 @@ void drm_mm_print(const struct drm_mm *mm, struct drm_printer *p)
 
 	drm_printf(p, "total: %llu, used %llu free %llu\n", total,
 		   total_used, total_free);
+
+	drm_mm_print_stats(mm, p);
 }
 EXPORT_SYMBOL(drm_mm_print);
+
+static unsigned int rb_depth(const struct rb_node *rb)
+{
+	unsigned int left, right;
+
+	if (!rb)
+		return 0;
+
+	left = rb_depth(rb->rb_left);
+	right = rb_depth(rb->rb_right);
+
+	return 1 + max(left, right);
+}
+
+static u64 div_or_zero(u64 a, u64 b)
+{
+	return b ? div64_u64(a, b) : 0;
+}
+
+/**
+ * drm_mm_print_stats - print allocator statistics
+ * @mm: drm_mm allocator to print
+ * @p: DRM printer to use
+ *
+ * Prints the operation counters from &drm_mm_stats together with a summary of
+ * the current layout: the number of nodes and holes, the largest hole, the
+ * external fragmentation (in per-mille of free space not available as a single
+ * hole) and the depth of each of the search trees. This walks every node and
+ * so is O(num_nodes).
+ */
+void drm_mm_print_stats(const struct drm_mm *mm, struct drm_printer *p)
+{
+	const struct drm_mm_stats *stats = &mm->stats;
+	const struct drm_mm_node *entry;
+	u64 nodes = 0, holes = 0, total_free = 0, largest = 0;
+	u64 frag;
+
+	if (drm_mm_hole_follows(&mm->head_node)) {
+		holes++;
+		total_free += mm->head_node.hole_size;
+		largest = mm->head_node.hole_size;
+	}
+
+	drm_mm_for_each_node(entry, mm) {
+		nodes++;
+		if (drm_mm_hole_follows(entry)) {
+			holes++;
+			total_free += entry->hole_size;
+			largest = max(largest, entry->hole_size);
+		}
+	}
+
+	frag = total_free ? 1000 - div64_u64(largest * 1000, total_free) : 0;
+
+	drm_printf(p, "nodes: %llu, holes: %llu, largest hole: %llu, fragmentation: %llu/1000\n",
+		   nodes, holes, largest, frag);
+	drm_printf(p, "tree depth: interval %u, hole size %u, hole addr %u\n",
+		   rb_depth(mm->interval_tree.rb_root.rb_node),
+		   rb_depth(mm->holes_size.rb_root.rb_node),
+		   rb_depth(mm->holes_addr.rb_node));
+	drm_printf(p, "insert: %llu ok (%llu from size classes), %llu failed, %llu searched, %llu holes/search, %llu ns/search\n",
+		   stats->insert, stats->insert_class,
+		   stats->insert_fail, stats->insert_search,
+		   div_or_zero(stats->insert_holes, stats->insert_search),
+		   div_or_zero(stats->insert_ns, stats->insert_search));
+	drm_printf(p, "remove: %llu, %llu ns/op, reserve: %llu\n",
+		   stats->remove, div_or_zero(stats->remove_ns, stats->remove),
+		   stats->reserve);
+	drm_printf(p, "scan: %llu added, %llu evicted\n",
+		   stats->scan_add, stats->scan_evict);
+}
+EXPORT_SYMBOL(drm_mm_print_stats);
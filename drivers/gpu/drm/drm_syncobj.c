@@ -125,6 +125,7 @@
 #include <linux/anon_inodes.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/log2.h>
 #include <linux/sched/signal.h>
 #include <linux/sync_file.h>
 #include <linux/uaccess.h>
@@ -144,10 +145,39 @@ struct syncobj_wait_entry {
 	struct dma_fence *fence;
 	struct dma_fence_cb fence_cb;
 	u64    point;
+
+	/* Only set for entries of drm_syncobj_array_wait_timeout() */
+	struct syncobj_waiter *waiter;
+	u32    idx;
+	bool   signaled;
+};
+
+/*
+ * State of one drm_syncobj_array_wait_timeout() call. Fence callbacks count
+ * @pending down and only wake up the waiting task once the wait is
+ * satisfied, so a wakeup does not need to look at every entry again.
+ * Waiters are kept in a small per-file pool to avoid allocating the entry
+ * and point arrays on every wait.
+ */
+struct syncobj_waiter {
+	struct list_head pool_link;
+	u32 capacity;
+	u32 flags;
+	atomic_t pending;
+	atomic_t first;		/* index of the first entry to signal, or -1 */
+	struct task_struct *task;
+	u64 *points;
+	struct syncobj_wait_entry entries[];
 };
 
+/* Waiters kept per file and the largest waiter worth keeping */
+#define DRM_SYNCOBJ_WAIT_POOL_SIZE	4
+#define DRM_SYNCOBJ_WAIT_POOL_MAX_COUNT	4096
+#define DRM_SYNCOBJ_WAIT_MIN_COUNT	16
+
 static void syncobj_wait_syncobj_func(struct drm_syncobj *syncobj,
 				      struct syncobj_wait_entry *wait);
+static void syncobj_wait_entry_arm(struct syncobj_wait_entry *wait);
 
 /**
  * drm_syncobj_find - lookup and reference a sync object.
@@ -197,6 +227,8 @@ static void drm_syncobj_fence_add_wait(struct drm_syncobj *syncobj,
 	} else {
 		wait->fence = fence;
 	}
+	if (wait->fence && wait->waiter)
+		syncobj_wait_entry_arm(wait);
 	spin_unlock(&syncobj->lock);
 }
 
@@ -657,6 +689,8 @@ drm_syncobj_open(struct drm_file *file_private)
 	idr_init(&file_private->syncobj_idr);
 #endif
 	spin_lock_init(&file_private->syncobj_table_lock);
+	INIT_LIST_HEAD(&file_private->syncobj_wait_pool);
+	file_private->syncobj_wait_pool_count = 0;
 }
 
 static int
@@ -679,9 +713,17 @@ drm_syncobj_release_handle(int id, void *ptr, void *data)
 void
 drm_syncobj_release(struct drm_file *file_private)
 {
+	struct syncobj_waiter *waiter, *tmp;
+
 	idr_for_each(&file_private->syncobj_idr,
 		     &drm_syncobj_release_handle, file_private);
 	idr_destroy(&file_private->syncobj_idr);
+
+	list_for_each_entry_safe(waiter, tmp, &file_private->syncobj_wait_pool,
+				 pool_link)
+		kfree(waiter);
+	INIT_LIST_HEAD(&file_private->syncobj_wait_pool);
+	file_private->syncobj_wait_pool_count = 0;
 }
 
 int
@@ -839,13 +881,34 @@ drm_syncobj_transfer_ioctl(struct drm_device *dev, void *data,
 	return ret;
 }
 
+static void syncobj_wait_entry_signal(struct syncobj_wait_entry *wait)
+{
+	struct syncobj_waiter *waiter = wait->waiter;
+
+	atomic_cmpxchg(&waiter->first, -1, wait->idx);
+	if (atomic_dec_and_test(&waiter->pending))
+		wake_up_process(waiter->task);
+}
+
 static void syncobj_wait_fence_func(struct dma_fence *fence,
 				    struct dma_fence_cb *cb)
 {
 	struct syncobj_wait_entry *wait =
 		container_of(cb, struct syncobj_wait_entry, fence_cb);
 
-	wake_up_process(wait->task);
+	syncobj_wait_entry_signal(wait);
+}
+
+/*
+ * Count the entry as signaled right away if its fence already signaled or
+ * only availability is waited for, otherwise have its fence callback do so.
+ */
+static void syncobj_wait_entry_arm(struct syncobj_wait_entry *wait)
+{
+	if ((wait->waiter->flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE) ||
+	    dma_fence_add_callback(wait->fence, &wait->fence_cb,
+				   syncobj_wait_fence_func))
+		syncobj_wait_entry_signal(wait);
 }
 
 static void syncobj_wait_syncobj_func(struct drm_syncobj *syncobj,
@@ -866,53 +929,118 @@ static void syncobj_wait_syncobj_func(struct drm_syncobj *syncobj,
 		wait->fence = fence;
 	}
 
-	wake_up_process(wait->task);
 	list_del_init(&wait->node);
+	if (wait->waiter)
+		syncobj_wait_entry_arm(wait);
+	else
+		wake_up_process(wait->task);
+}
+
+static struct syncobj_waiter *
+drm_syncobj_waiter_get(struct drm_file *file_private, uint32_t count)
+{
+	struct syncobj_waiter *waiter;
+	uint32_t capacity;
+
+	spin_lock(&file_private->syncobj_table_lock);
+	list_for_each_entry(waiter, &file_private->syncobj_wait_pool,
+			    pool_link) {
+		if (waiter->capacity >= count) {
+			list_del(&waiter->pool_link);
+			file_private->syncobj_wait_pool_count--;
+			spin_unlock(&file_private->syncobj_table_lock);
+			goto out;
+		}
+	}
+	spin_unlock(&file_private->syncobj_table_lock);
+
+	capacity = count;
+	if (capacity <= DRM_SYNCOBJ_WAIT_POOL_MAX_COUNT)
+		capacity = max_t(uint32_t, roundup_pow_of_two(capacity),
+				 DRM_SYNCOBJ_WAIT_MIN_COUNT);
+	if (capacity > (SIZE_MAX - sizeof(*waiter)) /
+	    (sizeof(waiter->entries[0]) + sizeof(u64)))
+		return NULL;
+
+	waiter = kmalloc(sizeof(*waiter) +
+			 capacity * (sizeof(waiter->entries[0]) + sizeof(u64)),
+			 GFP_KERNEL);
+	if (!waiter)
+		return NULL;
+	waiter->capacity = capacity;
+	waiter->points = (u64 *)&waiter->entries[capacity];
+
+out:
+	memset(waiter->entries, 0, count * sizeof(waiter->entries[0]));
+	return waiter;
+}
+
+static void drm_syncobj_waiter_put(struct drm_file *file_private,
+				   struct syncobj_waiter *waiter)
+{
+	if (waiter->capacity <= DRM_SYNCOBJ_WAIT_POOL_MAX_COUNT) {
+		spin_lock(&file_private->syncobj_table_lock);
+		if (file_private->syncobj_wait_pool_count <
+		    DRM_SYNCOBJ_WAIT_POOL_SIZE) {
+			list_add(&waiter->pool_link,
+				 &file_private->syncobj_wait_pool);
+			file_private->syncobj_wait_pool_count++;
+			waiter = NULL;
+		}
+		spin_unlock(&file_private->syncobj_table_lock);
+	}
+	kfree(waiter);
 }
 
-static signed long drm_syncobj_array_wait_timeout(struct drm_syncobj **syncobjs,
+static signed long drm_syncobj_array_wait_timeout(struct drm_file *file_private,
+						  struct drm_syncobj **syncobjs,
 						  void __user *user_points,
 						  uint32_t count,
 						  uint32_t flags,
 						  signed long timeout,
 						  uint32_t *idx)
 {
+	struct syncobj_waiter *waiter;
 	struct syncobj_wait_entry *entries;
-	struct dma_fence *fence;
-	uint64_t *points;
-	uint32_t signaled_count, i;
+	uint32_t i;
+	int first;
 
-	points = kmalloc_array(count, sizeof(*points), GFP_KERNEL);
-	if (points == NULL)
+	waiter = drm_syncobj_waiter_get(file_private, count);
+	if (waiter == NULL)
 		return -ENOMEM;
 
 	if (!user_points) {
-		memset(points, 0, count * sizeof(uint64_t));
+		memset(waiter->points, 0, count * sizeof(uint64_t));
 
-	} else if (copy_from_user(points, user_points,
+	} else if (copy_from_user(waiter->points, user_points,
 				  sizeof(uint64_t) * count)) {
 		timeout = -EFAULT;
-		goto err_free_points;
+		goto err_put_waiter;
 	}
 
-	entries = kcalloc(count, sizeof(*entries), GFP_KERNEL);
-	if (!entries) {
-		timeout = -ENOMEM;
-		goto err_free_points;
-	}
+	entries = waiter->entries;
+	waiter->task = current;
+	waiter->flags = flags;
+	/* Either every entry or just the first one needs to signal */
+	atomic_set(&waiter->pending,
+		   (flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL) ? count : 1);
+	atomic_set(&waiter->first, -1);
+
 	/* Walk the list of sync objects and initialize entries.  We do
 	 * this up-front so that we can properly return -EINVAL if there is
 	 * a syncobj with a missing fence and then never have the chance of
 	 * returning -EINVAL again.
 	 */
-	signaled_count = 0;
 	for (i = 0; i < count; ++i) {
 		struct dma_fence *fence;
 
 		entries[i].task = current;
-		entries[i].point = points[i];
+		entries[i].point = waiter->points[i];
+		entries[i].waiter = waiter;
+		entries[i].idx = i;
 		fence = drm_syncobj_fence_get(syncobjs[i]);
-		if (!fence || dma_fence_chain_find_seqno(&fence, points[i])) {
+		if (!fence || dma_fence_chain_find_seqno(&fence,
+							 entries[i].point)) {
 			dma_fence_put(fence);
 			if (flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT) {
 				continue;
@@ -929,66 +1057,46 @@ static signed long drm_syncobj_array_wait_timeout(struct drm_syncobj **syncobjs,
 
 		if ((flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE) ||
 		    dma_fence_is_signaled(entries[i].fence)) {
-			if (signaled_count == 0 && idx)
-				*idx = i;
-			signaled_count++;
+			entries[i].signaled = true;
+			syncobj_wait_entry_signal(&entries[i]);
 		}
 	}
 
-	if (signaled_count == count ||
-	    (signaled_count > 0 &&
-	     !(flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL)))
-		goto cleanup_entries;
+	if (atomic_read(&waiter->pending) <= 0)
+		goto done_waiting;
 
 	/* There's a very annoying laxness in the dma_fence API here, in
 	 * that backends are not required to automatically report when a
 	 * fence is signaled prior to fence->ops->enable_signaling() being
-	 * called.  So here if we fail to match signaled_count, we need to
-	 * fallthough and try a 0 timeout wait!
+	 * called.  Adding the callbacks enables signaling, so from here on
+	 * every fence reports through its callback and the entries never
+	 * need to be polled again.  Fences only showing up later on are
+	 * armed by syncobj_wait_syncobj_func().
 	 */
+	for (i = 0; i < count; ++i) {
+		if (atomic_read(&waiter->pending) <= 0)
+			break;
 
-	if (flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT) {
-		for (i = 0; i < count; ++i)
+		if (!entries[i].fence)
 			drm_syncobj_fence_add_wait(syncobjs[i], &entries[i]);
+		else if (!entries[i].signaled)
+			syncobj_wait_entry_arm(&entries[i]);
 	}
 
 	do {
 		set_current_state(TASK_INTERRUPTIBLE);
 
-		signaled_count = 0;
-		for (i = 0; i < count; ++i) {
-			fence = entries[i].fence;
-			if (!fence)
-				continue;
-
-			if ((flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE) ||
-			    dma_fence_is_signaled(fence) ||
-			    (!entries[i].fence_cb.func &&
-			     dma_fence_add_callback(fence,
-						    &entries[i].fence_cb,
-						    syncobj_wait_fence_func))) {
-				/* The fence has been signaled */
-				if (flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL) {
-					signaled_count++;
-				} else {
-					if (idx)
-						*idx = i;
-					goto done_waiting;
-				}
-			}
-		}
-
-		if (signaled_count == count)
-			goto done_waiting;
+		if (atomic_read(&waiter->pending) <= 0)
+			break;
 
 		if (timeout == 0) {
 			timeout = -ETIME;
-			goto done_waiting;
+			break;
 		}
 
 		if (signal_pending(current)) {
 			timeout = -ERESTARTSYS;
-			goto done_waiting;
+			break;
 		}
 
 		timeout = schedule_timeout(timeout);
@@ -997,6 +1105,10 @@ static signed long drm_syncobj_array_wait_timeout(struct drm_syncobj **syncobjs,
 done_waiting:
 	__set_current_state(TASK_RUNNING);
 
+	first = atomic_read(&waiter->first);
+	if (first >= 0 && idx)
+		*idx = first;
+
 cleanup_entries:
 	for (i = 0; i < count; ++i) {
 		drm_syncobj_remove_wait(syncobjs[i], &entries[i]);
@@ -1005,10 +1117,9 @@ cleanup_entries:
 						  &entries[i].fence_cb);
 		dma_fence_put(entries[i].fence);
 	}
-	kfree(entries);
 
-err_free_points:
-	kfree(points);
+err_put_waiter:
+	drm_syncobj_waiter_put(file_private, waiter);
 
 	return timeout;
 }
@@ -1057,7 +1168,8 @@ static int drm_syncobj_array_wait(struct drm_device *dev,
 
 	if (!timeline) {
 		timeout = drm_timeout_abs_to_jiffies(wait->timeout_nsec);
-		timeout = drm_syncobj_array_wait_timeout(syncobjs,
+		timeout = drm_syncobj_array_wait_timeout(file_private,
+							 syncobjs,
 							 NULL,
 							 wait->count_handles,
 							 wait->flags,
@@ -1067,7 +1179,8 @@ static int drm_syncobj_array_wait(struct drm_device *dev,
 		wait->first_signaled = first;
 	} else {
 		timeout = drm_timeout_abs_to_jiffies(timeline_wait->timeout_nsec);
-		timeout = drm_syncobj_array_wait_timeout(syncobjs,
+		timeout = drm_syncobj_array_wait_timeout(file_private,
+							 syncobjs,
 							 u64_to_user_ptr(timeline_wait->points),
 							 timeline_wait->count_handles,
 							 timeline_wait->flags,
@@ -1376,8 +1489,10 @@ int drm_syncobj_query_ioctl(struct drm_device *dev, void *data,
 		chain = to_dma_fence_chain(fence);
 		if (chain) {
 			struct dma_fence *iter, *last_signaled = NULL;
+			struct dma_fence_chain *skip;
 
-			dma_fence_chain_for_each(iter, fence) {
+			iter = dma_fence_get(fence);
+			while (iter) {
 				if (iter->context != fence->context) {
 					dma_fence_put(iter);
 					/* It is most likely that timeline has
@@ -1386,6 +1501,19 @@ int drm_syncobj_query_ioctl(struct drm_device *dev, void *data,
 				}
 				dma_fence_put(last_signaled);
 				last_signaled = dma_fence_get(iter);
+
+				/* Unsignaled points are never garbage
+				 * collected, so the walk would get there
+				 * anyway. Jump instead of walking.
+				 */
+				skip = to_dma_fence_chain(iter)->skip;
+				if (skip && !dma_fence_is_signaled(skip->fence)) {
+					dma_fence_get(&skip->base);
+					dma_fence_put(iter);
+					iter = &skip->base;
+				} else {
+					iter = dma_fence_chain_walk(iter);
+				}
 			}
 			point = dma_fence_is_signaled(last_signaled) ?
 				last_signaled->seqno :
@@ -124,10 +124,22 @@ __dma_fence_signal__notify(struct dma_fence *fence,
 			   const struct list_head *list)
 {
 	struct dma_fence_cb *cur, *tmp;
+#ifdef __FreeBSD__
+	unsigned int ncb = 0;
+#endif
 
 	lockdep_assert_held(fence->lock);
 	lockdep_assert_irqs_disabled();
 
+#ifdef __FreeBSD__
+	/* Callbacks may drop the last reference, so count them up front. */
+	if (fence->init_time != 0) {
+		list_for_each_entry(cur, list, node)
+			ncb++;
+		dma_fence_stats_signaled(fence, ncb);
+	}
+#endif
+
 	list_for_each_entry_safe(cur, tmp, list, node) {
 		INIT_LIST_HEAD(&cur->node);
 		cur->func(fence, cur);
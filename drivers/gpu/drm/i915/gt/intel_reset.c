@@ -629,7 +629,9 @@ static void revoke_mmaps(struct intel_gt *gt)
 	int i;
 
 	for (i = 0; i < gt->ggtt->num_fences; i++) {
+#ifdef __linux__
 		struct drm_vma_offset_node *node;
+#endif
 		struct i915_vma *vma;
 		u64 vma_offset;
 
@@ -641,7 +643,9 @@ static void revoke_mmaps(struct intel_gt *gt)
 			continue;
 
 		GEM_BUG_ON(vma->fence != &gt->ggtt->fence_regs[i]);
+#ifdef __linux__
 		node = &vma->obj->base.vma_node;
+#endif
 		vma_offset = vma->ggtt_view.partial.offset << PAGE_SHIFT;
 #ifdef __linux__
 		unmap_mapping_range(gt->i915->drm.anon_inode->i_mapping,
@@ -649,10 +653,7 @@ static void revoke_mmaps(struct intel_gt *gt)
 				    vma->size,
 				    1);
 #elif defined(__FreeBSD__)
-		unmap_mapping_range(vma->obj,
-				    drm_vma_node_offset_addr(node),
-				    drm_vma_node_size(node) << PAGE_SHIFT,
-				    1);
+		unmap_mapping_range(vma->obj, vma_offset, vma->size, 1);
 #endif
 	}
 }
@@ -65,6 +65,85 @@ mark_free(struct drm_mm_scan *scan,
 	return drm_mm_scan_add_block(scan, &vma->node);
 }
 
+static u64 eviction_cost(const struct i915_vma *vma)
+{
+	/* Unbinding an active vma stalls on the GPU, prefer idle ones */
+	if (i915_vma_is_active(vma))
+		return vma->node.size * 4;
+
+	return vma->node.size;
+}
+
+/*
+ * Rather than evicting in LRU order until a large enough hole appears, offer
+ * every evictable vma to drm_mm_scan_batch() at once and evict the cheapest
+ * neighbouring set, which avoids evicting scattered small objects when a large
+ * contiguous hole is required. Returns -ENOSPC if the caller should fall back
+ * to the LRU scan.
+ */
+static int evict_cheapest(struct i915_address_space *vm,
+			  struct drm_mm_scan *scan,
+			  unsigned int flags)
+{
+	struct drm_mm_scan_candidate *candidates;
+	struct drm_mm_node *node;
+	struct i915_vma *vma;
+	unsigned int count, first, i;
+	int n, ret;
+
+	count = 0;
+	list_for_each_entry(vma, &vm->bound_list, vm_link)
+		count++;
+	if (!count)
+		return -ENOSPC;
+
+	candidates = kvmalloc_array(count, sizeof(*candidates),
+				    GFP_KERNEL | __GFP_NORETRY | __GFP_NOWARN);
+	if (!candidates)
+		return -ENOSPC;
+
+	count = 0;
+	list_for_each_entry(vma, &vm->bound_list, vm_link) {
+		if (i915_vma_is_pinned(vma))
+			continue;
+
+		if (flags & PIN_NONBLOCK && i915_vma_is_active(vma))
+			continue;
+
+		candidates[count].node = &vma->node;
+		candidates[count].cost = eviction_cost(vma);
+		count++;
+	}
+
+	n = drm_mm_scan_batch(scan, candidates, count, &first);
+	if (n < 0) {
+		kvfree(candidates);
+		return n;
+	}
+
+	/* Unbinding may retire requests and so unbind other vmas, pin first */
+	for (i = first; i < first + n; i++) {
+		vma = container_of(candidates[i].node, struct i915_vma, node);
+		__i915_vma_pin(vma);
+	}
+
+	ret = 0;
+	for (i = first; i < first + n; i++) {
+		vma = container_of(candidates[i].node, struct i915_vma, node);
+		__i915_vma_unpin(vma);
+		if (ret == 0)
+			ret = i915_vma_unbind(vma);
+	}
+	kvfree(candidates);
+
+	while (ret == 0 && (node = drm_mm_scan_color_evict(scan))) {
+		vma = container_of(node, struct i915_vma, node);
+		ret = i915_vma_unbind(vma);
+	}
+
+	return ret;
+}
+
 /**
  * i915_gem_evict_something - Evict vmas to make room for binding a new one
  * @vm: address space to evict from
@@ -136,6 +215,12 @@ i915_gem_evict_something(struct i915_address_space *vm,
 	if (!(flags & PIN_NONBLOCK))
 		i915_retire_requests(dev_priv);
 
+	if (mode == DRM_MM_INSERT_BEST) {
+		ret = evict_cheapest(vm, &scan, flags);
+		if (ret != -ENOSPC)
+			return ret;
+	}
+
 search_again:
 	active = NULL;
 	INIT_LIST_HEAD(&eviction_list);
@@ -861,7 +861,9 @@ static void __i915_vma_iounmap(struct i915_vma *vma)
 
 void i915_vma_revoke_mmap(struct i915_vma *vma)
 {
+#ifdef __linux__
 	struct drm_vma_offset_node *node = &vma->obj->base.vma_node;
+#endif
 	u64 vma_offset;
 
 	lockdep_assert_held(&vma->vm->mutex);
@@ -879,8 +881,7 @@ void i915_vma_revoke_mmap(struct i915_vma *vma)
 			    vma->size,
 			    1);
 #elif defined(__FreeBSD__)
-	unmap_mapping_range(vma->obj, drm_vma_node_offset_addr(node),
-	    drm_vma_node_size(node) << PAGE_SHIFT, 1);
+	unmap_mapping_range(vma->obj, vma_offset, vma->size, 1);
 #endif
 
 	i915_vma_unset_userfault(vma);
@@ -60,6 +60,7 @@ int drm_sched_entity_init(struct drm_sched_entity *entity,
 
 	memset(entity, 0, sizeof(struct drm_sched_entity));
 	INIT_LIST_HEAD(&entity->list);
+	RB_CLEAR_NODE(&entity->rb_node);
 	entity->rq = NULL;
 	entity->guilty = guilty;
 	entity->num_rq_list = num_rq_list;
@@ -68,6 +69,14 @@ int drm_sched_entity_init(struct drm_sched_entity *entity,
 	if (!entity->rq_list)
 		return -ENOMEM;
 
+	entity->stats = kzalloc(sizeof(*entity->stats), GFP_KERNEL);
+	if (!entity->stats) {
+		kfree(entity->rq_list);
+		entity->rq_list = NULL;
+		return -ENOMEM;
+	}
+	kref_init(&entity->stats->refcount);
+
 	for (i = 0; i < num_rq_list; ++i)
 		entity->rq_list[i] = rq_list[i];
 
@@ -86,6 +95,22 @@ int drm_sched_entity_init(struct drm_sched_entity *entity,
 }
 EXPORT_SYMBOL(drm_sched_entity_init);
 
+/**
+ * drm_sched_entity_stats_release - free the runtime accounting of an entity
+ *
+ * @kref: reference count of the &drm_sched_entity_stats
+ *
+ * Called once the entity and all scheduler fences it created are gone.
+ */
+void drm_sched_entity_stats_release(struct kref *kref)
+{
+	struct drm_sched_entity_stats *stats =
+		container_of(kref, struct drm_sched_entity_stats, refcount);
+
+	kfree(stats);
+}
+EXPORT_SYMBOL(drm_sched_entity_stats_release);
+
 /**
  * drm_sched_entity_is_idle - Check if entity is idle
  *
@@ -122,18 +147,39 @@ bool drm_sched_entity_is_ready(struct drm_sched_entity *entity)
 	return true;
 }
 
+/**
+ * drm_sched_entity_job_cost - Estimate the runtime of the entity's next job
+ *
+ * @entity: scheduler entity
+ * @sched: scheduler the job will run on
+ *
+ * Entities without history are assumed to submit average jobs.
+ */
+static u64 drm_sched_entity_job_cost(struct drm_sched_entity *entity,
+				     struct drm_gpu_scheduler *sched)
+{
+	u64 cost = atomic64_read(&entity->stats->avg_job);
+
+	if (!cost)
+		cost = atomic64_read(&sched->avg_job);
+
+	return max_t(u64, cost, 1);
+}
+
 /**
  * drm_sched_entity_get_free_sched - Get the rq from rq_list with least load
  *
  * @entity: scheduler entity
  *
- * Return the pointer to the rq with least load.
+ * Return the pointer to the rq whose scheduler has the least estimated
+ * outstanding work, the number of jobs breaks ties.
  */
 static struct drm_sched_rq *
 drm_sched_entity_get_free_sched(struct drm_sched_entity *entity)
 {
 	struct drm_sched_rq *rq = NULL;
 	unsigned int min_jobs = UINT_MAX, num_jobs;
+	u64 min_cost = U64_MAX, cost;
 	int i;
 
 	for (i = 0; i < entity->num_rq_list; ++i) {
@@ -144,8 +190,11 @@ drm_sched_entity_get_free_sched(struct drm_sched_entity *entity)
 			continue;
 		}
 
+		cost = atomic64_read(&sched->pending_cost);
 		num_jobs = atomic_read(&sched->num_jobs);
-		if (num_jobs < min_jobs) {
+		if (cost < min_cost ||
+		    (cost == min_cost && num_jobs < min_jobs)) {
+			min_cost = cost;
 			min_jobs = num_jobs;
 			rq = entity->rq_list[i];
 		}
@@ -307,8 +356,8 @@ void drm_sched_entity_fini(struct drm_sched_entity *entity)
 			/* Park the kernel for a moment to make sure it isn't processing
 			 * our enity.
 			 */
-			kthread_park(sched->thread);
-			kthread_unpark(sched->thread);
+			drm_sched_park(sched);
+			drm_sched_unpark(sched);
 		}
 		if (entity->dependency) {
 			dma_fence_remove_callback(entity->dependency,
@@ -323,6 +372,8 @@ void drm_sched_entity_fini(struct drm_sched_entity *entity)
 	dma_fence_put(entity->last_scheduled);
 	entity->last_scheduled = NULL;
 	kfree(entity->rq_list);
+	drm_sched_entity_stats_put(entity->stats);
+	entity->stats = NULL;
 }
 EXPORT_SYMBOL(drm_sched_entity_fini);
 
@@ -488,6 +539,7 @@ struct drm_sched_job *drm_sched_entity_pop_job(struct drm_sched_entity *entity)
 	entity->last_scheduled = dma_fence_get(&sched_job->s_fence->finished);
 
 	spsc_queue_pop(&entity->job_queue);
+	drm_sched_rq_update_entity(entity->rq, entity);
 	return sched_job;
 }
 
@@ -540,6 +592,9 @@ void drm_sched_entity_push_job(struct drm_sched_job *sched_job,
 
 	trace_drm_sched_job(sched_job, entity);
 	atomic_inc(&entity->rq->sched->num_jobs);
+	sched_job->s_fence->cost = drm_sched_entity_job_cost(entity,
+							     sched_job->sched);
+	atomic64_add(sched_job->s_fence->cost, &sched_job->sched->pending_cost);
 	WRITE_ONCE(entity->last_user, current->group_leader);
 	first = spsc_queue_push(&entity->job_queue, &sched_job->queue_node);
 
@@ -60,9 +60,47 @@ void drm_sched_fence_scheduled(struct drm_sched_fence *fence)
 				"was already signaled\n");
 }
 
+/*
+ * Charge the time the job occupied the ring to its entity and drop its
+ * estimate from the scheduler's outstanding work. Jobs on a ring complete in
+ * order, so the time before the previous job finished was spent waiting
+ * behind it and belongs to that job's entity instead.
+ */
+static void drm_sched_fence_charge(struct drm_sched_fence *fence)
+{
+	struct drm_gpu_scheduler *sched = fence->sched;
+	ktime_t now, start;
+	u64 runtime;
+
+	atomic64_sub(xchg(&fence->cost, 0), &sched->pending_cost);
+
+	if (!fence->stats ||
+	    !test_bit(DMA_FENCE_FLAG_TIMESTAMP_BIT, &fence->scheduled.flags) ||
+	    test_bit(DMA_FENCE_FLAG_SIGNALED_BIT, &fence->finished.flags))
+		return;
+
+	now = ktime_get();
+	start = READ_ONCE(sched->last_finished);
+	if (ktime_before(start, fence->scheduled.timestamp))
+		start = fence->scheduled.timestamp;
+	WRITE_ONCE(sched->last_finished, now);
+
+	if (!ktime_after(now, start))
+		return;
+
+	runtime = ktime_to_ns(ktime_sub(now, start));
+	atomic64_add(runtime, &fence->stats->runtime);
+	atomic64_add(runtime, &sched->busy_time);
+	drm_sched_avg_update(&fence->stats->avg_job, runtime);
+	drm_sched_avg_update(&sched->avg_job, runtime);
+}
+
 void drm_sched_fence_finished(struct drm_sched_fence *fence)
 {
-	int ret = dma_fence_signal(&fence->finished);
+	int ret;
+
+	drm_sched_fence_charge(fence);
+	ret = dma_fence_signal(&fence->finished);
 
 	if (!ret)
 		DMA_FENCE_TRACE(&fence->finished,
@@ -111,6 +149,7 @@ static void drm_sched_fence_release_scheduled(struct dma_fence *f)
 	struct drm_sched_fence *fence = to_drm_sched_fence(f);
 
 	dma_fence_put(fence->parent);
+	drm_sched_entity_stats_put(fence->stats);
 	call_rcu(&fence->finished.rcu, drm_sched_fence_free);
 }
 
@@ -164,6 +203,7 @@ struct drm_sched_fence *drm_sched_fence_create(struct drm_sched_entity *entity,
 
 	fence->owner = owner;
 	fence->sched = entity->rq->sched;
+	fence->stats = drm_sched_entity_stats_get(entity->stats);
 	spin_lock_init(&fence->lock);
 
 	seq = atomic_inc_return(&entity->fence_seq);
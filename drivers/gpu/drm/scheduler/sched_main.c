@@ -42,9 +42,17 @@
  *    the hardware.
  *
  * The jobs in a entity are always scheduled in the order that they were pushed.
+ *
+ * With the sched_policy module parameter set to 1, run queues pick the ready
+ * entity which consumed the least GPU time instead of going round robin.
+ *
+ * By default every scheduler submits from its own kernel thread. With the
+ * sched_workqueue module parameter set, schedulers are instead run as work
+ * items on a workqueue shared by all of them, so idle rings cost no thread.
  */
 
 #include <linux/kthread.h>
+#include <linux/module.h>
 #include <linux/wait.h>
 #include <linux/sched.h>
 #include <uapi/linux/sched/types.h>
@@ -61,6 +69,66 @@
 
 static void drm_sched_process_job(struct dma_fence *f, struct dma_fence_cb *cb);
 
+static int drm_sched_policy = DRM_SCHED_POLICY_RR;
+MODULE_PARM_DESC(sched_policy, "Entity selection policy for new schedulers "
+"(0 = round robin (default), 1 = fair share of GPU time)");
+module_param_named(sched_policy, drm_sched_policy, int, 0644);
+
+static bool drm_sched_use_workqueue;
+MODULE_PARM_DESC(sched_workqueue, "Run new schedulers on a shared workqueue "
+"instead of a kthread per ring (default false)");
+module_param_named(sched_workqueue, drm_sched_use_workqueue, bool, 0644);
+
+/*
+ * The workqueue of schedulers running without a kthread. It is created for
+ * the first such scheduler and destroyed with the last one, so that
+ * submission does not queue behind unrelated work on the system queues.
+ * LinuxKPI's alloc_workqueue() ignores WQ_HIGHPRI, so on FreeBSD its
+ * threads run at the ordinary taskqueue priority, not above other work.
+ */
+static DEFINE_MUTEX(drm_sched_wq_lock);
+static struct workqueue_struct *drm_sched_wq;
+static unsigned int drm_sched_wq_users;
+
+static int drm_sched_wq_get(void)
+{
+	int ret = 0;
+
+	mutex_lock(&drm_sched_wq_lock);
+	if (!drm_sched_wq)
+		drm_sched_wq = alloc_workqueue("drm_sched", WQ_HIGHPRI, 0);
+	if (drm_sched_wq)
+		drm_sched_wq_users++;
+	else
+		ret = -ENOMEM;
+	mutex_unlock(&drm_sched_wq_lock);
+
+	return ret;
+}
+
+static void drm_sched_wq_put(void)
+{
+	mutex_lock(&drm_sched_wq_lock);
+	if (--drm_sched_wq_users == 0) {
+		destroy_workqueue(drm_sched_wq);
+		drm_sched_wq = NULL;
+	}
+	mutex_unlock(&drm_sched_wq_lock);
+}
+
+/**
+ * drm_sched_wakeup_worker - kick the scheduler's kthread or work item
+ *
+ * @sched: scheduler instance
+ */
+static void drm_sched_wakeup_worker(struct drm_gpu_scheduler *sched)
+{
+	if (sched->use_wq)
+		queue_work(drm_sched_wq, &sched->work_run);
+	else
+		wake_up_interruptible(&sched->wake_up_worker);
+}
+
 /**
  * drm_sched_rq_init - initialize a given run queue struct
  *
@@ -74,9 +142,54 @@ static void drm_sched_rq_init(struct drm_gpu_scheduler *sched,
 	spin_lock_init(&rq->lock);
 	INIT_LIST_HEAD(&rq->entities);
 	rq->current_entity = NULL;
+	rq->rb_tree = RB_ROOT_CACHED;
+	rq->min_vruntime = 0;
 	rq->sched = sched;
 }
 
+static void drm_sched_rq_remove_fair_locked(struct drm_sched_rq *rq,
+					    struct drm_sched_entity *entity)
+{
+	if (RB_EMPTY_NODE(&entity->rb_node))
+		return;
+	rb_erase_cached(&entity->rb_node, &rq->rb_tree);
+	RB_CLEAR_NODE(&entity->rb_node);
+}
+
+static void drm_sched_rq_insert_fair_locked(struct drm_sched_rq *rq,
+					    struct drm_sched_entity *entity)
+{
+	struct rb_node **link = &rq->rb_tree.rb_root.rb_node;
+	struct rb_node *parent = NULL;
+	bool leftmost = true;
+	u64 vruntime;
+
+	/*
+	 * An entity coming back from idle starts at the current minimum,
+	 * otherwise it could monopolize the ring until it caught up.
+	 */
+	vruntime = atomic64_read(&entity->stats->runtime) +
+		entity->vruntime_offset;
+	if (vruntime < rq->min_vruntime) {
+		entity->vruntime_offset += rq->min_vruntime - vruntime;
+		vruntime = rq->min_vruntime;
+	}
+	entity->vruntime = vruntime;
+
+	while (*link) {
+		parent = *link;
+		if (vruntime < rb_entry(parent, struct drm_sched_entity,
+					rb_node)->vruntime) {
+			link = &parent->rb_left;
+		} else {
+			link = &parent->rb_right;
+			leftmost = false;
+		}
+	}
+	rb_link_node(&entity->rb_node, parent, link);
+	rb_insert_color_cached(&entity->rb_node, &rq->rb_tree, leftmost);
+}
+
 /**
  * drm_sched_rq_add_entity - add an entity
  *
@@ -88,10 +201,21 @@ static void drm_sched_rq_init(struct drm_gpu_scheduler *sched,
 void drm_sched_rq_add_entity(struct drm_sched_rq *rq,
 			     struct drm_sched_entity *entity)
 {
-	if (!list_empty(&entity->list))
+	bool fair = rq->sched->policy == DRM_SCHED_POLICY_FAIR;
+
+	/*
+	 * With the fair policy the tree membership must be checked under the
+	 * lock, drm_sched_rq_update_entity() may be taking the entity out
+	 * after it saw an empty queue.
+	 */
+	if (!fair && !list_empty(&entity->list))
 		return;
 	spin_lock(&rq->lock);
-	list_add_tail(&entity->list, &rq->entities);
+	if (list_empty(&entity->list))
+		list_add_tail(&entity->list, &rq->entities);
+	if (fair && RB_EMPTY_NODE(&entity->rb_node) &&
+	    spsc_queue_count(&entity->job_queue))
+		drm_sched_rq_insert_fair_locked(rq, entity);
 	spin_unlock(&rq->lock);
 }
 
@@ -110,20 +234,82 @@ void drm_sched_rq_remove_entity(struct drm_sched_rq *rq,
 		return;
 	spin_lock(&rq->lock);
 	list_del_init(&entity->list);
+	drm_sched_rq_remove_fair_locked(rq, entity);
 	if (rq->current_entity == entity)
 		rq->current_entity = NULL;
 	spin_unlock(&rq->lock);
 }
 
 /**
- * drm_sched_rq_select_entity - Select an entity which could provide a job to run
+ * drm_sched_rq_update_entity - requeue an entity after popping a job
+ *
+ * @rq: scheduler run queue
+ * @entity: scheduler entity
+ *
+ * With the fair policy the entity is sorted again by the runtime charged
+ * to it so far, or leaves the tree once its queue ran empty. The next
+ * drm_sched_entity_push_job() puts it back.
+ */
+void drm_sched_rq_update_entity(struct drm_sched_rq *rq,
+				struct drm_sched_entity *entity)
+{
+	if (rq->sched->policy != DRM_SCHED_POLICY_FAIR)
+		return;
+
+	spin_lock(&rq->lock);
+	if (!RB_EMPTY_NODE(&entity->rb_node)) {
+		drm_sched_rq_remove_fair_locked(rq, entity);
+		if (spsc_queue_count(&entity->job_queue))
+			drm_sched_rq_insert_fair_locked(rq, entity);
+	}
+	spin_unlock(&rq->lock);
+}
+
+/**
+ * drm_sched_rq_select_entity_fair - Select the least served ready entity
+ *
+ * @rq: scheduler run queue to check.
+ *
+ * Only entities with queued jobs are in the tree, so this usually stops at
+ * the leftmost node unless it waits for a dependency.
+ */
+static struct drm_sched_entity *
+drm_sched_rq_select_entity_fair(struct drm_sched_rq *rq)
+{
+	struct drm_sched_entity *entity;
+	struct rb_node *rb;
+
+	spin_lock(&rq->lock);
+
+	rb = rb_first_cached(&rq->rb_tree);
+	if (rb) {
+		entity = rb_entry(rb, struct drm_sched_entity, rb_node);
+		rq->min_vruntime = max(rq->min_vruntime, entity->vruntime);
+	}
+
+	for (; rb; rb = rb_next(rb)) {
+		entity = rb_entry(rb, struct drm_sched_entity, rb_node);
+		if (drm_sched_entity_is_ready(entity)) {
+			rq->current_entity = entity;
+			spin_unlock(&rq->lock);
+			return entity;
+		}
+	}
+
+	spin_unlock(&rq->lock);
+
+	return NULL;
+}
+
+/**
+ * drm_sched_rq_select_entity_rr - Select an entity which could provide a job to run
  *
  * @rq: scheduler run queue to check.
  *
  * Try to find a ready entity, returns NULL if none found.
  */
 static struct drm_sched_entity *
-drm_sched_rq_select_entity(struct drm_sched_rq *rq)
+drm_sched_rq_select_entity_rr(struct drm_sched_rq *rq)
 {
 	struct drm_sched_entity *entity;
 
@@ -157,6 +343,22 @@ drm_sched_rq_select_entity(struct drm_sched_rq *rq)
 	return NULL;
 }
 
+/**
+ * drm_sched_rq_select_entity - Select an entity according to the policy
+ *
+ * @rq: scheduler run queue to check.
+ *
+ * Returns NULL if no entity is ready.
+ */
+static struct drm_sched_entity *
+drm_sched_rq_select_entity(struct drm_sched_rq *rq)
+{
+	if (rq->sched->policy == DRM_SCHED_POLICY_FAIR)
+		return drm_sched_rq_select_entity_fair(rq);
+
+	return drm_sched_rq_select_entity_rr(rq);
+}
+
 /**
  * drm_sched_dependency_optimized
  *
@@ -367,7 +569,7 @@ void drm_sched_stop(struct drm_gpu_scheduler *sched, struct drm_sched_job *bad)
 	struct drm_sched_job *s_job, *tmp;
 	unsigned long flags;
 
-	kthread_park(sched->thread);
+	drm_sched_park(sched);
 
 	/*
 	 * Iterate the job list from later to  earlier one and either deactive
@@ -464,7 +666,7 @@ void drm_sched_start(struct drm_gpu_scheduler *sched, bool full_recovery)
 		spin_unlock_irqrestore(&sched->job_list_lock, flags);
 	}
 
-	kthread_unpark(sched->thread);
+	drm_sched_unpark(sched);
 }
 EXPORT_SYMBOL(drm_sched_start);
 
@@ -579,7 +781,7 @@ static bool drm_sched_ready(struct drm_gpu_scheduler *sched)
 void drm_sched_wakeup(struct drm_gpu_scheduler *sched)
 {
 	if (drm_sched_ready(sched))
-		wake_up_interruptible(&sched->wake_up_worker);
+		drm_sched_wakeup_worker(sched);
 }
 
 /**
@@ -628,7 +830,7 @@ static void drm_sched_process_job(struct dma_fence *f, struct dma_fence_cb *cb)
 	trace_drm_sched_process_job(s_fence);
 
 	drm_sched_fence_finished(s_fence);
-	wake_up_interruptible(&sched->wake_up_worker);
+	drm_sched_wakeup_worker(sched);
 }
 
 /**
@@ -688,6 +890,51 @@ static bool drm_sched_blocked(struct drm_gpu_scheduler *sched)
 	return false;
 }
 
+/**
+ * drm_sched_run_entity - submit the next job of an entity to the hardware
+ *
+ * @sched: scheduler instance
+ * @entity: entity returned by drm_sched_select_entity()
+ */
+static void drm_sched_run_entity(struct drm_gpu_scheduler *sched,
+				 struct drm_sched_entity *entity)
+{
+	struct drm_sched_fence *s_fence;
+	struct drm_sched_job *sched_job;
+	struct dma_fence *fence;
+	int r;
+
+	sched_job = drm_sched_entity_pop_job(entity);
+	if (!sched_job)
+		return;
+
+	s_fence = sched_job->s_fence;
+
+	atomic_inc(&sched->hw_rq_count);
+	drm_sched_job_begin(sched_job);
+
+	fence = sched->ops->run_job(sched_job);
+	drm_sched_fence_scheduled(s_fence);
+
+	if (!IS_ERR_OR_NULL(fence)) {
+		s_fence->parent = dma_fence_get(fence);
+		r = dma_fence_add_callback(fence, &sched_job->cb,
+					   drm_sched_process_job);
+		if (r == -ENOENT)
+			drm_sched_process_job(fence, &sched_job->cb);
+		else if (r)
+			DRM_ERROR("fence add callback failed (%d)\n",
+				  r);
+		dma_fence_put(fence);
+	} else {
+
+		dma_fence_set_error(&s_fence->finished, PTR_ERR(fence));
+		drm_sched_process_job(NULL, &sched_job->cb);
+	}
+
+	wake_up(&sched->job_scheduled);
+}
+
 /**
  * drm_sched_main - main scheduler thread
  *
@@ -699,15 +946,11 @@ static int drm_sched_main(void *param)
 {
 	struct sched_param sparam = {.sched_priority = 1};
 	struct drm_gpu_scheduler *sched = (struct drm_gpu_scheduler *)param;
-	int r;
 
 	sched_setscheduler(current, SCHED_FIFO, &sparam);
 
 	while (!kthread_should_stop()) {
 		struct drm_sched_entity *entity = NULL;
-		struct drm_sched_fence *s_fence;
-		struct drm_sched_job *sched_job;
-		struct dma_fence *fence;
 
 		wait_event_interruptible(sched->wake_up_worker,
 					 (drm_sched_cleanup_jobs(sched),
@@ -718,38 +961,72 @@ static int drm_sched_main(void *param)
 		if (!entity)
 			continue;
 
-		sched_job = drm_sched_entity_pop_job(entity);
-		if (!sched_job)
-			continue;
+		drm_sched_run_entity(sched, entity);
+	}
+	return 0;
+}
 
-		s_fence = sched_job->s_fence;
+/**
+ * drm_sched_work - scheduler work item on the shared worker pool
+ *
+ * @work: &drm_gpu_scheduler.work_run
+ *
+ * Submits at most one job and requeues itself, so the rings sharing the
+ * pool interleave instead of one ring draining all of its entities first.
+ * Completions and dependency callbacks queue it again once it went idle.
+ */
+static void drm_sched_work(struct work_struct *work)
+{
+	struct drm_gpu_scheduler *sched =
+		container_of(work, struct drm_gpu_scheduler, work_run);
+	struct drm_sched_entity *entity;
 
-		atomic_inc(&sched->hw_rq_count);
-		drm_sched_job_begin(sched_job);
+	if (READ_ONCE(sched->paused))
+		return;
 
-		fence = sched->ops->run_job(sched_job);
-		drm_sched_fence_scheduled(s_fence);
+	drm_sched_cleanup_jobs(sched);
 
-		if (!IS_ERR_OR_NULL(fence)) {
-			s_fence->parent = dma_fence_get(fence);
-			r = dma_fence_add_callback(fence, &sched_job->cb,
-						   drm_sched_process_job);
-			if (r == -ENOENT)
-				drm_sched_process_job(fence, &sched_job->cb);
-			else if (r)
-				DRM_ERROR("fence add callback failed (%d)\n",
-					  r);
-			dma_fence_put(fence);
-		} else {
+	entity = drm_sched_select_entity(sched);
+	if (!entity)
+		return;
 
-			dma_fence_set_error(&s_fence->finished, PTR_ERR(fence));
-			drm_sched_process_job(NULL, &sched_job->cb);
-		}
+	drm_sched_run_entity(sched, entity);
+	queue_work(drm_sched_wq, &sched->work_run);
+}
 
-		wake_up(&sched->job_scheduled);
+/**
+ * drm_sched_park - stop submitting jobs
+ *
+ * @sched: scheduler instance
+ *
+ * Waits until the kthread or work item is no longer submitting a job.
+ */
+void drm_sched_park(struct drm_gpu_scheduler *sched)
+{
+	if (sched->use_wq) {
+		WRITE_ONCE(sched->paused, true);
+		cancel_work_sync(&sched->work_run);
+	} else {
+		kthread_park(sched->thread);
 	}
-	return 0;
 }
+EXPORT_SYMBOL(drm_sched_park);
+
+/**
+ * drm_sched_unpark - resume submitting jobs after drm_sched_park()
+ *
+ * @sched: scheduler instance
+ */
+void drm_sched_unpark(struct drm_gpu_scheduler *sched)
+{
+	if (sched->use_wq) {
+		WRITE_ONCE(sched->paused, false);
+		queue_work(drm_sched_wq, &sched->work_run);
+	} else {
+		kthread_unpark(sched->thread);
+	}
+}
+EXPORT_SYMBOL(drm_sched_unpark);
 
 /**
  * drm_sched_init - Init a gpu scheduler instance
@@ -776,6 +1053,13 @@ int drm_sched_init(struct drm_gpu_scheduler *sched,
 	sched->name = name;
 	sched->timeout = timeout;
 	sched->hang_limit = hang_limit;
+	sched->policy = drm_sched_policy;
+	if (sched->policy < 0 || sched->policy >= DRM_SCHED_POLICY_COUNT)
+		sched->policy = DRM_SCHED_POLICY_RR;
+	sched->last_finished = 0;
+	atomic64_set(&sched->pending_cost, 0);
+	atomic64_set(&sched->busy_time, 0);
+	atomic64_set(&sched->avg_job, 0);
 	for (i = DRM_SCHED_PRIORITY_MIN; i < DRM_SCHED_PRIORITY_MAX; i++)
 		drm_sched_rq_init(sched, &sched->sched_rq[i]);
 
@@ -787,6 +1071,21 @@ int drm_sched_init(struct drm_gpu_scheduler *sched,
 	INIT_DELAYED_WORK(&sched->work_tdr, drm_sched_job_timedout);
 	atomic_set(&sched->num_jobs, 0);
 	atomic64_set(&sched->job_id_count, 0);
+	INIT_WORK(&sched->work_run, drm_sched_work);
+	sched->paused = false;
+	sched->use_wq = drm_sched_use_workqueue;
+
+	if (sched->use_wq) {
+		ret = drm_sched_wq_get();
+		if (ret) {
+			sched->use_wq = false;
+			DRM_ERROR("Failed to create scheduler workqueue for %s.\n",
+				  name);
+			return ret;
+		}
+		sched->ready = true;
+		return 0;
+	}
 
 	/* Each scheduler will run on a seperate kernel thread */
 	sched->thread = kthread_run(drm_sched_main, sched, sched->name);
@@ -813,6 +1112,12 @@ void drm_sched_fini(struct drm_gpu_scheduler *sched)
 {
 	if (sched->thread)
 		kthread_stop(sched->thread);
+	if (sched->use_wq) {
+		WRITE_ONCE(sched->paused, true);
+		cancel_work_sync(&sched->work_run);
+		drm_sched_wq_put();
+		sched->use_wq = false;
+	}
 
 	sched->ready = false;
 }
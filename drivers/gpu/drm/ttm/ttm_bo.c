@@ -42,6 +42,10 @@
 #include <linux/module.h>
 #include <linux/atomic.h>
 #include <linux/dma-resv.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/llist.h>
+#include <linux/delay.h>
 
 static void ttm_bo_global_kobj_release(struct kobject *kobj);
 
@@ -52,6 +56,103 @@ DEFINE_MUTEX(ttm_global_mutex);
 unsigned ttm_bo_glob_use_count;
 struct ttm_bo_global ttm_bo_glob;
 
+/* Evictable BOs looked at by the scored eviction policy */
+#define TTM_EVICT_SCAN 16
+
+static unsigned ttm_evict_batch = 32;
+MODULE_PARM_DESC(evict_batch,
+	"Buffer objects evicted per batch when a memory type is evacuated (0 = one at a time)");
+module_param_named(evict_batch, ttm_evict_batch, uint, 0644);
+
+static int ttm_evict_policy = TTM_EVICT_LRU;
+MODULE_PARM_DESC(evict_policy,
+	"Default eviction policy of new devices (0 = LRU, 1 = scored)");
+module_param_named(evict_policy, ttm_evict_policy, int, 0644);
+
+#ifdef __FreeBSD__
+#include <sys/counter.h>
+
+static SYSCTL_NODE(_hw_ttm, OID_AUTO, evict, CTLFLAG_RW | CTLFLAG_MPSAFE, 0,
+    "TTM memory type evacuation");
+
+static counter_u64_t ttm_bo_evict_runs;
+static counter_u64_t ttm_bo_evict_bytes;
+static counter_u64_t ttm_bo_evict_usecs;
+static counter_u64_t ttm_bo_evict_evictions;
+static counter_u64_t ttm_bo_evict_refaults;
+SYSCTL_COUNTER_U64(_hw_ttm_evict, OID_AUTO, runs, CTLFLAG_RD,
+    &ttm_bo_evict_runs, "Memory types evacuated");
+SYSCTL_COUNTER_U64(_hw_ttm_evict, OID_AUTO, bytes, CTLFLAG_RD,
+    &ttm_bo_evict_bytes, "Bytes moved while evacuating memory types");
+SYSCTL_COUNTER_U64(_hw_ttm_evict, OID_AUTO, usecs, CTLFLAG_RD,
+    &ttm_bo_evict_usecs, "Wall time spent evacuating memory types (us)");
+SYSCTL_COUNTER_U64(_hw_ttm_evict, OID_AUTO, evictions, CTLFLAG_RD,
+    &ttm_bo_evict_evictions, "Buffer objects evicted");
+SYSCTL_COUNTER_U64(_hw_ttm_evict, OID_AUTO, refaults, CTLFLAG_RD,
+    &ttm_bo_evict_refaults, "Evicted buffer objects moved back");
+
+static void
+ttm_bo_evict_counters_init(void *arg __unused)
+{
+
+	ttm_bo_evict_runs = counter_u64_alloc(M_WAITOK);
+	ttm_bo_evict_bytes = counter_u64_alloc(M_WAITOK);
+	ttm_bo_evict_usecs = counter_u64_alloc(M_WAITOK);
+	ttm_bo_evict_evictions = counter_u64_alloc(M_WAITOK);
+	ttm_bo_evict_refaults = counter_u64_alloc(M_WAITOK);
+}
+SYSINIT(ttm_bo_evict, SI_SUB_DRIVERS, SI_ORDER_ANY, ttm_bo_evict_counters_init,
+    NULL);
+
+static void
+ttm_bo_evict_counters_uninit(void *arg __unused)
+{
+
+	counter_u64_free(ttm_bo_evict_runs);
+	counter_u64_free(ttm_bo_evict_bytes);
+	counter_u64_free(ttm_bo_evict_usecs);
+	counter_u64_free(ttm_bo_evict_evictions);
+	counter_u64_free(ttm_bo_evict_refaults);
+}
+SYSUNINIT(ttm_bo_evict, SI_SUB_DRIVERS, SI_ORDER_ANY,
+    ttm_bo_evict_counters_uninit, NULL);
+
+static SYSCTL_NODE(_hw_ttm, OID_AUTO, ddestroy, CTLFLAG_RW | CTLFLAG_MPSAFE, 0,
+    "TTM delayed destruction");
+
+static counter_u64_t ttm_bo_ddestroy_callbacks;
+static counter_u64_t ttm_bo_ddestroy_batches;
+static counter_u64_t ttm_bo_ddestroy_reaped;
+SYSCTL_COUNTER_U64(_hw_ttm_ddestroy, OID_AUTO, callbacks, CTLFLAG_RD,
+    &ttm_bo_ddestroy_callbacks, "Delayed destroy fence callbacks armed");
+SYSCTL_COUNTER_U64(_hw_ttm_ddestroy, OID_AUTO, batches, CTLFLAG_RD,
+    &ttm_bo_ddestroy_batches, "Delayed destroy worker runs");
+SYSCTL_COUNTER_U64(_hw_ttm_ddestroy, OID_AUTO, reaped, CTLFLAG_RD,
+    &ttm_bo_ddestroy_reaped, "Buffer objects destroyed by the worker");
+
+static void
+ttm_bo_ddestroy_counters_init(void *arg __unused)
+{
+
+	ttm_bo_ddestroy_callbacks = counter_u64_alloc(M_WAITOK);
+	ttm_bo_ddestroy_batches = counter_u64_alloc(M_WAITOK);
+	ttm_bo_ddestroy_reaped = counter_u64_alloc(M_WAITOK);
+}
+SYSINIT(ttm_bo_ddestroy, SI_SUB_DRIVERS, SI_ORDER_ANY,
+    ttm_bo_ddestroy_counters_init, NULL);
+
+static void
+ttm_bo_ddestroy_counters_uninit(void *arg __unused)
+{
+
+	counter_u64_free(ttm_bo_ddestroy_callbacks);
+	counter_u64_free(ttm_bo_ddestroy_batches);
+	counter_u64_free(ttm_bo_ddestroy_reaped);
+}
+SYSUNINIT(ttm_bo_ddestroy, SI_SUB_DRIVERS, SI_ORDER_ANY,
+    ttm_bo_ddestroy_counters_uninit, NULL);
+#endif
+
 static struct attribute ttm_bo_count = {
 	.name = "bo_count",
 	.mode = S_IRUGO
@@ -189,6 +290,7 @@ static void ttm_bo_add_mem_to_lru(struct ttm_buffer_object *bo,
 	man = &bdev->man[mem->mem_type];
 	list_add_tail(&bo->lru, &man->lru[bo->priority]);
 	kref_get(&bo->list_kref);
+	bo->lru_jiffies = jiffies;
 
 	if (!(man->flags & TTM_MEMTYPE_FLAG_FIXED) && bo->ttm &&
 	    !(bo->ttm->page_flags & (TTM_PAGE_FLAG_SG |
@@ -272,6 +374,28 @@ void ttm_bo_move_to_lru_tail(struct ttm_buffer_object *bo,
 }
 EXPORT_SYMBOL(ttm_bo_move_to_lru_tail);
 
+/*
+ * A bulk move refreshes the BOs in @pos without going through
+ * ttm_bo_add_mem_to_lru(), stamp them as recently used here. Only the
+ * scored policy reads the stamp, so the walk is skipped otherwise to keep
+ * the bulk move O(1).
+ */
+static void ttm_bo_bulk_move_stamp(struct ttm_lru_bulk_move_pos *pos)
+{
+	struct ttm_buffer_object *bo = pos->first;
+	unsigned long now = jiffies;
+
+	if (bo->bdev->evict_policy != TTM_EVICT_SCORED)
+		return;
+
+	for (;;) {
+		bo->lru_jiffies = now;
+		if (bo == pos->last)
+			break;
+		bo = list_next_entry(bo, lru);
+	}
+}
+
 void ttm_bo_bulk_move_lru_tail(struct ttm_lru_bulk_move *bulk)
 {
 	unsigned i;
@@ -287,6 +411,7 @@ void ttm_bo_bulk_move_lru_tail(struct ttm_lru_bulk_move *bulk)
 		dma_resv_assert_held(pos->last->base.resv);
 
 		man = &pos->first->bdev->man[TTM_PL_TT];
+		ttm_bo_bulk_move_stamp(pos);
 		list_bulk_move_tail(&man->lru[i], &pos->first->lru,
 				    &pos->last->lru);
 	}
@@ -302,6 +427,7 @@ void ttm_bo_bulk_move_lru_tail(struct ttm_lru_bulk_move *bulk)
 		dma_resv_assert_held(pos->last->base.resv);
 
 		man = &pos->first->bdev->man[TTM_PL_VRAM];
+		ttm_bo_bulk_move_stamp(pos);
 		list_bulk_move_tail(&man->lru[i], &pos->first->lru,
 				    &pos->last->lru);
 	}
@@ -396,6 +522,12 @@ static int ttm_bo_handle_move_mem(struct ttm_buffer_object *bo,
 
 moved:
 	if (bo->evicted) {
+		if (!evict) {
+			bo->refaults++;
+#ifdef __FreeBSD__
+			counter_u64_add(ttm_bo_evict_refaults, 1);
+#endif
+		}
 		if (bdev->driver->invalidate_caches) {
 			ret = bdev->driver->invalidate_caches(bdev, bo->mem.placement);
 			if (ret)
@@ -477,6 +609,98 @@ static void ttm_bo_flush_all_fences(struct ttm_buffer_object *bo)
 	}
 }
 
+static void ttm_bo_ddestroy_cb(struct dma_fence *fence,
+			       struct dma_fence_cb *cb)
+{
+	struct ttm_buffer_object *bo =
+	    container_of(cb, struct ttm_buffer_object, ddestroy_cb);
+	struct ttm_bo_device *bdev = bo->bdev;
+
+	if (llist_add(&bo->ddestroy_node, &bdev->ddestroy_ready) &&
+	    !READ_ONCE(bdev->ddestroy_paused))
+		schedule_work(&bdev->ddestroy_work);
+}
+
+/*
+ * Arm a callback on the first unsignaled fence of @bo's individualized
+ * reservation object, or hand @bo to the ddestroy worker right away if it
+ * is idle. The caller holds the reference owned by the callback.
+ */
+static int ttm_bo_ddestroy_arm(struct ttm_buffer_object *bo)
+{
+	struct dma_fence *excl, **shared;
+	unsigned count, i;
+	bool armed = false;
+	int ret;
+
+	ret = dma_resv_get_fences_rcu(&bo->base._resv, &excl, &count, &shared);
+	if (ret)
+		return ret;
+
+	for (i = 0; i <= count; ++i) {
+		struct dma_fence *fence = i < count ? shared[i] : excl;
+
+		if (!fence)
+			continue;
+
+		if (!armed) {
+			bo->ddestroy_fence = dma_fence_get(fence);
+			armed = !dma_fence_add_callback(fence, &bo->ddestroy_cb,
+							ttm_bo_ddestroy_cb);
+			if (!armed) {
+				bo->ddestroy_fence = NULL;
+				dma_fence_put(fence);
+			}
+		}
+		dma_fence_put(fence);
+	}
+	kfree(shared);
+
+	/* Idle already */
+	if (!armed)
+		ttm_bo_ddestroy_cb(NULL, &bo->ddestroy_cb);
+#ifdef __FreeBSD__
+	counter_u64_add(ttm_bo_ddestroy_callbacks, 1);
+#endif
+
+	return 0;
+}
+
+static void ttm_bo_ddestroy_put(struct ttm_buffer_object *bo)
+{
+	struct ttm_bo_device *bdev = bo->bdev;
+
+	spin_lock(&bdev->ddestroy_lock);
+	list_del_init(&bo->ddestroy_pending);
+	spin_unlock(&bdev->ddestroy_lock);
+
+	dma_fence_put(bo->ddestroy_fence);
+	bo->ddestroy_fence = NULL;
+	kref_put(&bo->list_kref, ttm_bo_release_list);
+}
+
+/*
+ * Have @bo, which is queued for delayed destruction and has an individual
+ * reservation object, handed to the ddestroy worker once its fences have
+ * signaled. The worker owns a list reference until it is done with the BO.
+ */
+static int ttm_bo_ddestroy_queue(struct ttm_buffer_object *bo)
+{
+	struct ttm_bo_device *bdev = bo->bdev;
+	int ret;
+
+	kref_get(&bo->list_kref);
+	spin_lock(&bdev->ddestroy_lock);
+	list_add_tail(&bo->ddestroy_pending, &bdev->ddestroy_pending);
+	spin_unlock(&bdev->ddestroy_lock);
+
+	ret = ttm_bo_ddestroy_arm(bo);
+	if (ret)
+		ttm_bo_ddestroy_put(bo);
+
+	return ret;
+}
+
 static void ttm_bo_cleanup_refs_or_queue(struct ttm_buffer_object *bo)
 {
 	struct ttm_bo_device *bdev = bo->bdev;
@@ -525,11 +749,30 @@ static void ttm_bo_cleanup_refs_or_queue(struct ttm_buffer_object *bo)
 	if (bo->base.resv != &bo->base._resv)
 		dma_resv_unlock(&bo->base._resv);
 
+	/*
+	 * The fences are in the BO's own reservation object now, so it can be
+	 * destroyed from a fence callback instead of polling the delayed
+	 * destroy list.
+	 */
+	kref_get(&bo->list_kref);
+	list_add_tail(&bo->ddestroy, &bdev->ddestroy_async);
+	spin_unlock(&glob->lru_lock);
+
+	if (!ttm_bo_ddestroy_queue(bo))
+		return;
+
+	spin_lock(&glob->lru_lock);
+	if (!list_empty(&bo->ddestroy))
+		list_move_tail(&bo->ddestroy, &bdev->ddestroy);
+	spin_unlock(&glob->lru_lock);
+	goto out;
+
 error:
 	kref_get(&bo->list_kref);
 	list_add_tail(&bo->ddestroy, &bdev->ddestroy);
 	spin_unlock(&glob->lru_lock);
 
+out:
 	schedule_delayed_work(&bdev->wq,
 			      ((HZ / 100) < 1) ? 1 : HZ / 100);
 }
@@ -617,6 +860,89 @@ static int ttm_bo_cleanup_refs(struct ttm_buffer_object *bo,
 	return 0;
 }
 
+/**
+ * Destroy the BOs whose delayed destroy fence callback fired. Idle BOs are
+ * taken off the LRU and delayed destroy lists in one lru_lock hold, BOs
+ * which picked up another unsignaled fence get their callback re-armed.
+ */
+static void ttm_bo_ddestroy_work(struct work_struct *work)
+{
+	struct ttm_bo_device *bdev =
+	    container_of(work, struct ttm_bo_device, ddestroy_work);
+	struct ttm_bo_global *glob = bdev->glob;
+	struct ttm_buffer_object *bo, *next;
+	struct llist_node *ready;
+	LLIST_HEAD(reap);
+	LLIST_HEAD(contended);
+	LLIST_HEAD(busy);
+	LLIST_HEAD(done);
+	unsigned long reaped = 0;
+
+	if (READ_ONCE(bdev->ddestroy_paused))
+		return;
+
+	ready = llist_del_all(&bdev->ddestroy_ready);
+	if (!ready)
+		return;
+
+	spin_lock(&glob->lru_lock);
+	llist_for_each_entry_safe(bo, next, ready, ddestroy_node) {
+		if (list_empty(&bo->ddestroy)) {
+			/* Already destroyed by eviction or swapout */
+			llist_add(&bo->ddestroy_node, &done);
+		} else if (!dma_resv_test_signaled_rcu(&bo->base._resv, true)) {
+			llist_add(&bo->ddestroy_node, &busy);
+		} else if (dma_resv_trylock(bo->base.resv)) {
+			ttm_bo_del_from_lru(bo);
+			list_del_init(&bo->ddestroy);
+			kref_put(&bo->list_kref, ttm_bo_ref_bug);
+			llist_add(&bo->ddestroy_node, &reap);
+		} else {
+			llist_add(&bo->ddestroy_node, &contended);
+		}
+	}
+	spin_unlock(&glob->lru_lock);
+
+	llist_for_each_entry_safe(bo, next, reap.first, ddestroy_node) {
+		ttm_bo_cleanup_memtype_use(bo);
+		dma_resv_unlock(bo->base.resv);
+		ttm_bo_ddestroy_put(bo);
+		reaped++;
+	}
+
+	/* The BO shares a contended reservation object, wait for it */
+	llist_for_each_entry_safe(bo, next, contended.first, ddestroy_node) {
+		dma_resv_lock(bo->base.resv, NULL);
+		spin_lock(&glob->lru_lock);
+		ttm_bo_cleanup_refs(bo, false, false, true);
+		ttm_bo_ddestroy_put(bo);
+		reaped++;
+	}
+
+	llist_for_each_entry_safe(bo, next, busy.first, ddestroy_node) {
+		dma_fence_put(bo->ddestroy_fence);
+		bo->ddestroy_fence = NULL;
+		if (!ttm_bo_ddestroy_arm(bo))
+			continue;
+
+		spin_lock(&glob->lru_lock);
+		if (!list_empty(&bo->ddestroy))
+			list_move_tail(&bo->ddestroy, &bdev->ddestroy);
+		spin_unlock(&glob->lru_lock);
+		schedule_delayed_work(&bdev->wq,
+				      ((HZ / 100) < 1) ? 1 : HZ / 100);
+		ttm_bo_ddestroy_put(bo);
+	}
+
+	llist_for_each_entry_safe(bo, next, done.first, ddestroy_node)
+		ttm_bo_ddestroy_put(bo);
+
+#ifdef __FreeBSD__
+	counter_u64_add(ttm_bo_ddestroy_batches, 1);
+	counter_u64_add(ttm_bo_ddestroy_reaped, reaped);
+#endif
+}
+
 /**
  * Traverse the delayed list, and call ttm_bo_cleanup_refs on all
  * encountered buffers.
@@ -694,23 +1020,38 @@ EXPORT_SYMBOL(ttm_bo_put);
 
 int ttm_bo_lock_delayed_workqueue(struct ttm_bo_device *bdev)
 {
+	WRITE_ONCE(bdev->ddestroy_paused, true);
+	cancel_work_sync(&bdev->ddestroy_work);
 	return cancel_delayed_work_sync(&bdev->wq);
 }
 EXPORT_SYMBOL(ttm_bo_lock_delayed_workqueue);
 
 void ttm_bo_unlock_delayed_workqueue(struct ttm_bo_device *bdev, int resched)
 {
+	WRITE_ONCE(bdev->ddestroy_paused, false);
+	/*
+	 * Pairs with the fully ordered llist_add() in ttm_bo_ddestroy_cb():
+	 * either the callback sees the queue unpaused, or we see its BO.
+	 */
+	smp_mb();
+	if (!llist_empty(&bdev->ddestroy_ready))
+		schedule_work(&bdev->ddestroy_work);
 	if (resched)
 		schedule_delayed_work(&bdev->wq,
 				      ((HZ / 100) < 1) ? 1 : HZ / 100);
 }
 EXPORT_SYMBOL(ttm_bo_unlock_delayed_workqueue);
 
-static int ttm_bo_evict(struct ttm_buffer_object *bo,
-			struct ttm_operation_ctx *ctx)
+/*
+ * Find space for evicting @bo and store it in @evict_mem. Returns 1 if the
+ * driver asked for the BO to be dropped instead and there is nothing left
+ * to move.
+ */
+static int ttm_bo_evict_mem_space(struct ttm_buffer_object *bo,
+				  struct ttm_mem_reg *evict_mem,
+				  struct ttm_operation_ctx *ctx)
 {
 	struct ttm_bo_device *bdev = bo->bdev;
-	struct ttm_mem_reg evict_mem;
 	struct ttm_placement placement;
 	int ret = 0;
 
@@ -725,34 +1066,56 @@ static int ttm_bo_evict(struct ttm_buffer_object *bo,
 		if (ret)
 			return ret;
 
-		return ttm_tt_create(bo, false);
+		ret = ttm_tt_create(bo, false);
+		return ret ? ret : 1;
 	}
 
-	evict_mem = bo->mem;
-	evict_mem.mm_node = NULL;
-	evict_mem.bus.io_reserved_vm = false;
-	evict_mem.bus.io_reserved_count = 0;
+	*evict_mem = bo->mem;
+	evict_mem->mm_node = NULL;
+	evict_mem->bus.io_reserved_vm = false;
+	evict_mem->bus.io_reserved_count = 0;
 
-	ret = ttm_bo_mem_space(bo, &placement, &evict_mem, ctx);
-	if (ret) {
-		if (ret != -ERESTARTSYS) {
-			pr_err("Failed to find memory space for buffer 0x%p eviction\n",
-			       bo);
-			ttm_bo_mem_space_debug(bo, &placement);
-		}
-		goto out;
+	ret = ttm_bo_mem_space(bo, &placement, evict_mem, ctx);
+	if (ret && ret != -ERESTARTSYS) {
+		pr_err("Failed to find memory space for buffer 0x%p eviction\n",
+		       bo);
+		ttm_bo_mem_space_debug(bo, &placement);
 	}
 
-	ret = ttm_bo_handle_move_mem(bo, &evict_mem, true, ctx);
+	return ret;
+}
+
+static int ttm_bo_evict_move(struct ttm_buffer_object *bo,
+			     struct ttm_mem_reg *evict_mem,
+			     struct ttm_operation_ctx *ctx)
+{
+	int ret;
+
+	ret = ttm_bo_handle_move_mem(bo, evict_mem, true, ctx);
 	if (unlikely(ret)) {
 		if (ret != -ERESTARTSYS)
 			pr_err("Buffer eviction failed\n");
-		ttm_bo_mem_put(bo, &evict_mem);
-		goto out;
+		ttm_bo_mem_put(bo, evict_mem);
+		return ret;
 	}
 	bo->evicted = true;
-out:
-	return ret;
+#ifdef __FreeBSD__
+	counter_u64_add(ttm_bo_evict_evictions, 1);
+#endif
+	return 0;
+}
+
+static int ttm_bo_evict(struct ttm_buffer_object *bo,
+			struct ttm_operation_ctx *ctx)
+{
+	struct ttm_mem_reg evict_mem;
+	int ret;
+
+	ret = ttm_bo_evict_mem_space(bo, &evict_mem, ctx);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
+	return ttm_bo_evict_move(bo, &evict_mem, ctx);
 }
 
 bool ttm_bo_eviction_valuable(struct ttm_buffer_object *bo,
@@ -837,48 +1200,166 @@ static int ttm_mem_evict_wait_busy(struct ttm_buffer_object *busy_bo,
 	return r == -EDEADLK ? -EBUSY : r;
 }
 
-static int ttm_mem_evict_first(struct ttm_bo_device *bdev,
-			       uint32_t mem_type,
-			       const struct ttm_place *place,
-			       struct ttm_operation_ctx *ctx,
-			       struct ww_acquire_ctx *ticket)
+static struct ttm_buffer_object *
+ttm_mem_evict_choose_lru(struct ttm_bo_device *bdev,
+			 struct ttm_mem_type_manager *man,
+			 const struct ttm_place *place,
+			 struct ttm_operation_ctx *ctx,
+			 struct ww_acquire_ctx *ticket, bool *locked,
+			 struct ttm_buffer_object **busy_bo)
 {
-	struct ttm_buffer_object *bo = NULL, *busy_bo = NULL;
-	struct ttm_bo_global *glob = bdev->glob;
-	struct ttm_mem_type_manager *man = &bdev->man[mem_type];
-	bool locked = false;
+	struct ttm_buffer_object *bo;
 	unsigned i;
-	int ret;
 
-	spin_lock(&glob->lru_lock);
 	for (i = 0; i < TTM_MAX_BO_PRIORITY; ++i) {
 		list_for_each_entry(bo, &man->lru[i], lru) {
 			bool busy;
 
-			if (!ttm_bo_evict_swapout_allowable(bo, ctx, &locked,
+			if (!ttm_bo_evict_swapout_allowable(bo, ctx, locked,
 							    &busy)) {
-				if (busy && !busy_bo && ticket !=
+				if (busy && !*busy_bo && ticket !=
 				    dma_resv_locking_ctx(bo->base.resv))
-					busy_bo = bo;
+					*busy_bo = bo;
 				continue;
 			}
 
 			if (place && !bdev->driver->eviction_valuable(bo,
 								      place)) {
-				if (locked)
+				if (*locked)
 					dma_resv_unlock(bo->base.resv);
 				continue;
 			}
-			break;
+			return bo;
 		}
+	}
 
-		/* If the inner loop terminated early, we have our candidate */
-		if (&bo->lru != &man->lru[i])
-			break;
+	return NULL;
+}
+
+/*
+ * Score @bo as an eviction victim for an allocation of @num_pages, higher is
+ * better. Called with the lru_lock held, the inputs are hints only.
+ */
+static uint64_t ttm_bo_evict_score(struct ttm_buffer_object *bo,
+				   unsigned long num_pages)
+{
+	unsigned long pages = max(bo->num_pages, 1UL);
+	uint64_t score;
+
+	if (!list_empty(&bo->ddestroy))
+		return U64_MAX;
+
+	/* Time since the BO was last validated, in ms up to a minute */
+	score = min(jiffies_to_msecs(jiffies - bo->lru_jiffies), 60000U) + 1;
+	score <<= 10;
 
-		bo = NULL;
+	/*
+	 * Prefer BOs about the size of the allocation. Evicting a small BO
+	 * rarely makes room for a large one, evicting a large BO for a small
+	 * allocation moves more than needed.
+	 */
+	if (num_pages && pages < num_pages)
+		score = div64_u64(score * pages, num_pages * 2);
+	else if (num_pages)
+		score = div64_u64(score * num_pages, pages);
+
+	/* Evicting a busy BO has to wait for the GPU first */
+	if (!dma_resv_test_signaled_rcu(bo->base.resv, true))
+		score >>= 2;
+
+	/* BOs which keep coming back after eviction are in the working set */
+	return div64_u64(score, 1 + min(READ_ONCE(bo->refaults), 15U));
+}
+
+/*
+ * Among the evictable BOs in the first TTM_EVICT_SCAN entries of the lowest
+ * priority LRU, choose the best scoring one. Only BOs that could be locked
+ * and are worth evicting are scored. If none is found in that window, the
+ * first evictable BO after it is taken unscored, as with TTM_EVICT_LRU. At
+ * most two candidates are locked at a time.
+ */
+static struct ttm_buffer_object *
+ttm_mem_evict_choose_scored(struct ttm_bo_device *bdev,
+			    struct ttm_mem_type_manager *man,
+			    const struct ttm_place *place,
+			    struct ttm_operation_ctx *ctx,
+			    struct ww_acquire_ctx *ticket,
+			    unsigned long num_pages, bool *locked,
+			    struct ttm_buffer_object **busy_bo)
+{
+	struct ttm_buffer_object *bo, *best = NULL;
+	uint64_t score, best_score = 0;
+	unsigned i, scanned;
+
+	for (i = 0; i < TTM_MAX_BO_PRIORITY && !best; ++i) {
+		scanned = 0;
+		list_for_each_entry(bo, &man->lru[i], lru) {
+			bool bo_locked, busy;
+
+			if (best && scanned >= TTM_EVICT_SCAN)
+				break;
+			++scanned;
+
+			if (!ttm_bo_evict_swapout_allowable(bo, ctx, &bo_locked,
+							    &busy)) {
+				if (busy && !*busy_bo && ticket !=
+				    dma_resv_locking_ctx(bo->base.resv))
+					*busy_bo = bo;
+				continue;
+			}
+
+			if (place && !bdev->driver->eviction_valuable(bo,
+								      place)) {
+				if (bo_locked)
+					dma_resv_unlock(bo->base.resv);
+				continue;
+			}
+
+			if (scanned > TTM_EVICT_SCAN) {
+				best = bo;
+				*locked = bo_locked;
+				break;
+			}
+
+			score = ttm_bo_evict_score(bo, num_pages);
+			if (best && score <= best_score) {
+				if (bo_locked)
+					dma_resv_unlock(bo->base.resv);
+				continue;
+			}
+
+			if (best && *locked)
+				dma_resv_unlock(best->base.resv);
+			best = bo;
+			best_score = score;
+			*locked = bo_locked;
+		}
 	}
 
+	return best;
+}
+
+static int ttm_mem_evict_first(struct ttm_bo_device *bdev,
+			       uint32_t mem_type,
+			       const struct ttm_place *place,
+			       unsigned long num_pages,
+			       struct ttm_operation_ctx *ctx,
+			       struct ww_acquire_ctx *ticket)
+{
+	struct ttm_buffer_object *bo, *busy_bo = NULL;
+	struct ttm_bo_global *glob = bdev->glob;
+	struct ttm_mem_type_manager *man = &bdev->man[mem_type];
+	bool locked = false;
+	int ret;
+
+	spin_lock(&glob->lru_lock);
+	if (bdev->evict_policy == TTM_EVICT_SCORED)
+		bo = ttm_mem_evict_choose_scored(bdev, man, place, ctx, ticket,
+						 num_pages, &locked, &busy_bo);
+	else
+		bo = ttm_mem_evict_choose_lru(bdev, man, place, ctx, ticket,
+					      &locked, &busy_bo);
+
 	if (!bo) {
 		if (busy_bo)
 			kref_get(&busy_bo->list_kref);
@@ -974,8 +1455,8 @@ static int ttm_bo_mem_force_space(struct ttm_buffer_object *bo,
 			return ret;
 		if (mem->mm_node)
 			break;
-		ret = ttm_mem_evict_first(bdev, mem->mem_type, place, ctx,
-					  ticket);
+		ret = ttm_mem_evict_first(bdev, mem->mem_type, place,
+					  mem->num_pages, ctx, ticket);
 		if (unlikely(ret != 0))
 			return ret;
 	} while (1);
@@ -1322,6 +1803,7 @@ int ttm_bo_init_reserved(struct ttm_bo_device *bdev,
 	INIT_LIST_HEAD(&bo->ddestroy);
 	INIT_LIST_HEAD(&bo->swap);
 	INIT_LIST_HEAD(&bo->io_reserve_lru);
+	INIT_LIST_HEAD(&bo->ddestroy_pending);
 	mutex_init(&bo->wu_mutex);
 	bo->bdev = bdev;
 	bo->type = type;
@@ -1474,6 +1956,84 @@ int ttm_bo_create(struct ttm_bo_device *bdev,
 }
 EXPORT_SYMBOL(ttm_bo_create);
 
+struct ttm_bo_evict_entry {
+	struct ttm_buffer_object *bo;
+	struct ttm_mem_reg mem;
+	int ret;
+};
+
+/*
+ * Evict up to @max BOs that can be trylocked from the LRU of @mem_type as
+ * one batch. They are not checked for idleness, busy BOs are moved behind
+ * their fences like on any other eviction. Space is found for the whole
+ * batch before the first move is issued, so the copies go to the move
+ * engine back to back and only the last one needs to be waited for.
+ * Returns the number of BOs taken off the LRU, 0 if none could be
+ * trylocked, or a negative error code.
+ */
+static int ttm_bo_evict_batch(struct ttm_bo_device *bdev, unsigned mem_type,
+			      struct ttm_operation_ctx *ctx,
+			      struct ttm_bo_evict_entry *batch, unsigned max)
+{
+	struct ttm_mem_type_manager *man = &bdev->man[mem_type];
+	struct ttm_bo_global *glob = bdev->glob;
+	struct ttm_buffer_object *bo, *tmp;
+	unsigned i, n = 0, reserved;
+	int ret = 0;
+
+	spin_lock(&glob->lru_lock);
+	for (i = 0; i < TTM_MAX_BO_PRIORITY && n < max; ++i) {
+		list_for_each_entry_safe(bo, tmp, &man->lru[i], lru) {
+			/* Delayed destroy and shared reservations take the
+			 * ttm_mem_evict_first() path.
+			 */
+			if (!list_empty(&bo->ddestroy) ||
+			    bo->base.resv == ctx->resv ||
+			    !dma_resv_trylock(bo->base.resv))
+				continue;
+
+			kref_get(&bo->list_kref);
+			ttm_bo_del_from_lru(bo);
+			batch[n++].bo = bo;
+			if (n == max)
+				break;
+		}
+	}
+	spin_unlock(&glob->lru_lock);
+
+	for (reserved = 0; reserved < n; ++reserved) {
+		struct ttm_bo_evict_entry *e = &batch[reserved];
+
+		e->ret = ttm_bo_evict_mem_space(e->bo, &e->mem, ctx);
+		if (e->ret < 0)
+			break;
+	}
+
+	/*
+	 * Running out of space part way through is not fatal, the rest of the
+	 * batch stays on the LRU and is retried once these moves are done.
+	 */
+	if (reserved == 0 && n)
+		ret = batch[0].ret;
+
+	for (i = 0; i < reserved; ++i) {
+		struct ttm_bo_evict_entry *e = &batch[i];
+
+		if (e->ret == 0) {
+			e->ret = ttm_bo_evict_move(e->bo, &e->mem, ctx);
+			if (e->ret && !ret)
+				ret = e->ret;
+		}
+	}
+
+	for (i = 0; i < n; ++i) {
+		ttm_bo_unreserve(batch[i].bo);
+		kref_put(&batch[i].bo->list_kref, ttm_bo_release_list);
+	}
+
+	return ret ? ret : n;
+}
+
 static int ttm_bo_force_list_clean(struct ttm_bo_device *bdev,
 				   unsigned mem_type)
 {
@@ -1484,10 +2044,17 @@ static int ttm_bo_force_list_clean(struct ttm_bo_device *bdev,
 	};
 	struct ttm_mem_type_manager *man = &bdev->man[mem_type];
 	struct ttm_bo_global *glob = bdev->glob;
+	struct ttm_bo_evict_entry *batch = NULL;
+	unsigned batch_size = READ_ONCE(ttm_evict_batch);
 	struct dma_fence *fence;
+	ktime_t start;
 	int ret;
 	unsigned i;
 
+	if (batch_size > 1)
+		batch = kmalloc_array(batch_size, sizeof(*batch), GFP_KERNEL);
+	start = ktime_get();
+
 	/*
 	 * Can't use standard list traversal since we're unlocking.
 	 */
@@ -1496,10 +2063,15 @@ static int ttm_bo_force_list_clean(struct ttm_bo_device *bdev,
 	for (i = 0; i < TTM_MAX_BO_PRIORITY; ++i) {
 		while (!list_empty(&man->lru[i])) {
 			spin_unlock(&glob->lru_lock);
-			ret = ttm_mem_evict_first(bdev, mem_type, NULL, &ctx,
-						  NULL);
-			if (ret)
-				return ret;
+			ret = 0;
+			if (batch)
+				ret = ttm_bo_evict_batch(bdev, mem_type, &ctx,
+							 batch, batch_size);
+			if (ret == 0)
+				ret = ttm_mem_evict_first(bdev, mem_type, NULL,
+							  0, &ctx, NULL);
+			if (ret < 0)
+				goto out;
 			spin_lock(&glob->lru_lock);
 		}
 	}
@@ -1509,14 +2081,26 @@ static int ttm_bo_force_list_clean(struct ttm_bo_device *bdev,
 	fence = dma_fence_get(man->move);
 	spin_unlock(&man->move_lock);
 
+	ret = 0;
 	if (fence) {
 		ret = dma_fence_wait(fence, false);
 		dma_fence_put(fence);
-		if (ret)
-			return ret;
 	}
 
-	return 0;
+out:
+	kfree(batch);
+	man->evict_bytes = ctx.bytes_moved;
+	man->evict_us = ktime_us_delta(ktime_get(), start);
+#ifdef __FreeBSD__
+	counter_u64_add(ttm_bo_evict_runs, 1);
+	counter_u64_add(ttm_bo_evict_bytes, man->evict_bytes);
+	counter_u64_add(ttm_bo_evict_usecs, man->evict_us);
+#endif
+	pr_debug("Evicted %llu bytes from memory type %u in %llu us\n",
+		 (unsigned long long)man->evict_bytes, mem_type,
+		 (unsigned long long)man->evict_us);
+
+	return ret;
 }
 
 int ttm_bo_clean_mm(struct ttm_bo_device *bdev, unsigned mem_type)
@@ -1675,6 +2259,58 @@ out:
 	return ret;
 }
 
+/*
+ * Drop the delayed destroy fence callbacks still armed when the device goes
+ * away. ttm_bo_delayed_delete() already waited for the fences, those left
+ * will likely never signal and must not call into a released device.
+ */
+static void ttm_bo_ddestroy_drain(struct ttm_bo_device *bdev)
+{
+	struct ttm_buffer_object *bo, *next;
+	unsigned long dropped = 0;
+
+	for (;;) {
+		LLIST_HEAD(removed);
+		bool empty;
+
+		/* Keep the worker from re-arming callbacks meanwhile */
+		WRITE_ONCE(bdev->ddestroy_paused, true);
+		cancel_work_sync(&bdev->ddestroy_work);
+
+		spin_lock(&bdev->ddestroy_lock);
+		list_for_each_entry(bo, &bdev->ddestroy_pending,
+				    ddestroy_pending) {
+			if (bo->ddestroy_fence &&
+			    dma_fence_remove_callback(bo->ddestroy_fence,
+						      &bo->ddestroy_cb))
+				llist_add(&bo->ddestroy_node, &removed);
+		}
+		spin_unlock(&bdev->ddestroy_lock);
+
+		llist_for_each_entry_safe(bo, next, removed.first,
+					  ddestroy_node) {
+			ttm_bo_ddestroy_put(bo);
+			dropped++;
+		}
+
+		/* The callbacks of the rest fired, let the worker finish them */
+		WRITE_ONCE(bdev->ddestroy_paused, false);
+		schedule_work(&bdev->ddestroy_work);
+		flush_work(&bdev->ddestroy_work);
+
+		spin_lock(&bdev->ddestroy_lock);
+		empty = list_empty(&bdev->ddestroy_pending);
+		spin_unlock(&bdev->ddestroy_lock);
+		if (empty)
+			break;
+		msleep(1);
+	}
+
+	if (dropped)
+		pr_err("Dropped %lu delayed destroy callbacks on unsignaled fences\n",
+		       dropped);
+}
+
 int ttm_bo_device_release(struct ttm_bo_device *bdev)
 {
 	int ret = 0;
@@ -1701,9 +2337,16 @@ int ttm_bo_device_release(struct ttm_bo_device *bdev)
 
 	cancel_delayed_work_sync(&bdev->wq);
 
+	spin_lock(&glob->lru_lock);
+	list_splice_tail_init(&bdev->ddestroy_async, &bdev->ddestroy);
+	spin_unlock(&glob->lru_lock);
+
 	if (ttm_bo_delayed_delete(bdev, true))
 		pr_debug("Delayed destroy list was clean\n");
 
+	ttm_bo_ddestroy_drain(bdev);
+	cancel_work_sync(&bdev->ddestroy_work);
+
 	spin_lock(&glob->lru_lock);
 	for (i = 0; i < TTM_MAX_BO_PRIORITY; ++i)
 		if (list_empty(&bdev->man[0].lru[0]))
@@ -1752,11 +2395,21 @@ int ttm_bo_device_init(struct ttm_bo_device *bdev,
 				    DRM_FILE_PAGE_OFFSET_SIZE);
 	INIT_DELAYED_WORK(&bdev->wq, ttm_bo_delayed_workqueue);
 	INIT_LIST_HEAD(&bdev->ddestroy);
+	INIT_LIST_HEAD(&bdev->ddestroy_async);
+	init_llist_head(&bdev->ddestroy_ready);
+	INIT_WORK(&bdev->ddestroy_work, ttm_bo_ddestroy_work);
+	spin_lock_init(&bdev->ddestroy_lock);
+	INIT_LIST_HEAD(&bdev->ddestroy_pending);
+	bdev->ddestroy_paused = false;
 #ifdef __linux__
 	bdev->dev_mapping = mapping;
 #endif
 	bdev->glob = glob;
 	bdev->need_dma32 = need_dma32;
+	if (ttm_evict_policy < 0 || ttm_evict_policy >= TTM_EVICT_COUNT)
+		bdev->evict_policy = TTM_EVICT_LRU;
+	else
+		bdev->evict_policy = ttm_evict_policy;
 	mutex_lock(&ttm_global_mutex);
 	list_add_tail(&bdev->device_list, &glob->device_list);
 	mutex_unlock(&ttm_global_mutex);
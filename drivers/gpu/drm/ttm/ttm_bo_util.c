@@ -40,6 +40,25 @@
 #include <linux/module.h>
 #include <linux/dma-resv.h>
 
+#ifdef CONFIG_AS_MOVNTDQA
+#ifdef __linux__
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+
+#define ttm_fpu_begin()	kernel_fpu_begin()
+#define ttm_fpu_end()	kernel_fpu_end()
+#elif defined(__FreeBSD__)
+#include <machine/fpu.h>
+#include <machine/specialreg.h>
+#include <x86/x86_var.h>
+
+/* Short, non-sleeping sections; no need for a saved FPU context. */
+#define ttm_fpu_begin()	fpu_kern_enter(curthread, NULL, FPU_KERN_NOCTX)
+#define ttm_fpu_end()	fpu_kern_leave(curthread, NULL)
+#define asm		__asm
+#endif
+#endif
+
 struct ttm_transfer_obj {
 	struct ttm_buffer_object base;
 	struct ttm_buffer_object *bo;
@@ -248,15 +267,104 @@ static void ttm_mem_reg_iounmap(struct ttm_bo_device *bdev, struct ttm_mem_reg *
 	ttm_mem_io_unlock(man);
 }
 
-static int ttm_copy_io_page(void *dst, void *src, unsigned long page)
+#ifdef CONFIG_AS_MOVNTDQA
+/* Bytes copied per FPU section, bounds the time spent non-preemptible. */
+#define TTM_MEMCPY_WC_CHUNK	(16 * PAGE_SIZE)
+
+static bool ttm_has_movntdqa(void)
+{
+#ifdef __linux__
+	/* Hypervisors may not emulate VEX-prefixed instructions. */
+	return static_cpu_has(X86_FEATURE_XMM4_1) &&
+		!boot_cpu_has(X86_FEATURE_HYPERVISOR);
+#elif defined(__FreeBSD__)
+	return (cpu_feature2 & CPUID2_SSE41) != 0;
+#endif
+}
+
+/*
+ * Copy with non-temporal loads and streaming stores, 64 bytes at a time.
+ * Reads from WC or UC memory are only fast with movntdqa, which fetches
+ * whole lines into the streaming load buffers; movntdq stores combine
+ * into full line writes without polluting the cache.
+ */
+static void __ttm_memcpy_ntdqa(void *dst, const void *src, unsigned long len)
+{
+	len >>= 4;
+	while (len >= 4) {
+		asm("movntdqa   (%0), %%xmm0\n"
+		    "movntdqa 16(%0), %%xmm1\n"
+		    "movntdqa 32(%0), %%xmm2\n"
+		    "movntdqa 48(%0), %%xmm3\n"
+		    "movntdq %%xmm0,   (%1)\n"
+		    "movntdq %%xmm1, 16(%1)\n"
+		    "movntdq %%xmm2, 32(%1)\n"
+		    "movntdq %%xmm3, 48(%1)\n"
+		    :: "r" (src), "r" (dst) : "memory");
+		src += 64;
+		dst += 64;
+		len -= 4;
+	}
+	while (len--) {
+		asm("movntdqa (%0), %%xmm0\n"
+		    "movntdq %%xmm0, (%1)\n"
+		    :: "r" (src), "r" (dst) : "memory");
+		src += 16;
+		dst += 16;
+	}
+}
+#endif
+
+/**
+ * ttm_memcpy_wc - bulk copy from and/or to WC, UC or iomem mappings
+ *
+ * @dst: destination, 16 byte aligned
+ * @src: source, 16 byte aligned
+ * @len: bytes to copy, a multiple of 16
+ *
+ * Returns false if the CPU has no suitable instructions or the arguments
+ * are misaligned, in which case the caller falls back to the io accessors.
+ */
+static bool ttm_memcpy_wc(void *dst, const void *src, unsigned long len)
+{
+#ifdef CONFIG_AS_MOVNTDQA
+	unsigned long chunk;
+
+	if (((unsigned long)dst | (unsigned long)src | len) & 15 ||
+	    !ttm_has_movntdqa())
+		return false;
+
+	while (len) {
+		chunk = min_t(unsigned long, len, TTM_MEMCPY_WC_CHUNK);
+		ttm_fpu_begin();
+		__ttm_memcpy_ntdqa(dst, src, chunk);
+		ttm_fpu_end();
+		dst += chunk;
+		src += chunk;
+		len -= chunk;
+	}
+	/* Order the streaming stores before whatever signals completion. */
+	asm volatile("sfence" ::: "memory");
+	return true;
+#else
+	return false;
+#endif
+}
+
+static int ttm_copy_io_page(void *dst, void *src, unsigned long page,
+			    unsigned long num_pages)
 {
 	uint32_t *dstP =
 	    (uint32_t *) ((unsigned long)dst + (page << PAGE_SHIFT));
 	uint32_t *srcP =
 	    (uint32_t *) ((unsigned long)src + (page << PAGE_SHIFT));
 
-	int i;
-	for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); ++i)
+	unsigned long i;
+
+	if (ttm_memcpy_wc(dstP, srcP, num_pages << PAGE_SHIFT))
+		return 0;
+
+	for (i = 0; i < (num_pages << PAGE_SHIFT) / sizeof(uint32_t); ++i)
 		iowrite32(ioread32(srcP++), dstP++);
 	return 0;
 }
@@ -309,8 +417,36 @@ void ttm_kunmap_atomic_prot(void *addr, pgprot_t prot)
 }
 EXPORT_SYMBOL(ttm_kunmap_atomic_prot);
 
+/*
+ * Number of pages from @page on, at most @max, that are physically
+ * contiguous. On 64-bit x86 those are also contiguous in the direct map
+ * ttm_kmap_atomic_prot() returns, so they can be copied as one run.
+ */
+static unsigned long ttm_tt_contig_pages(struct ttm_tt *ttm,
+					 unsigned long page,
+					 unsigned long max)
+{
+	unsigned long n = 1;
+
+#if defined(CONFIG_X86) && defined(CONFIG_64BIT)
+	phys_addr_t phys;
+
+	if (!ttm->pages[page])
+		return n;
+
+	phys = page_to_phys(ttm->pages[page]);
+	while (n < max && ttm->pages[page + n] &&
+	       page_to_phys(ttm->pages[page + n]) ==
+	       phys + ((phys_addr_t)n << PAGE_SHIFT))
+		n++;
+#endif
+
+	return n;
+}
+
 static int ttm_copy_io_ttm_page(struct ttm_tt *ttm, void *src,
 				unsigned long page,
+				unsigned long num_pages,
 				pgprot_t prot)
 {
 	struct page *d = ttm->pages[page];
@@ -324,7 +460,8 @@ static int ttm_copy_io_ttm_page(struct ttm_tt *ttm, void *src,
 	if (!dst)
 		return -ENOMEM;
 
-	memcpy_fromio(dst, src, PAGE_SIZE);
+	if (!ttm_memcpy_wc(dst, src, num_pages << PAGE_SHIFT))
+		memcpy_fromio(dst, src, num_pages << PAGE_SHIFT);
 
 	ttm_kunmap_atomic_prot(dst, prot);
 
@@ -333,6 +470,7 @@ static int ttm_copy_io_ttm_page(struct ttm_tt *ttm, void *src,
 
 static int ttm_copy_ttm_io_page(struct ttm_tt *ttm, void *dst,
 				unsigned long page,
+				unsigned long num_pages,
 				pgprot_t prot)
 {
 	struct page *s = ttm->pages[page];
@@ -346,7 +484,8 @@ static int ttm_copy_ttm_io_page(struct ttm_tt *ttm, void *dst,
 	if (!src)
 		return -ENOMEM;
 
-	memcpy_toio(dst, src, PAGE_SIZE);
+	if (!ttm_memcpy_wc(dst, src, num_pages << PAGE_SHIFT))
+		memcpy_toio(dst, src, num_pages << PAGE_SHIFT);
 
 	ttm_kunmap_atomic_prot(src, prot);
 
@@ -367,6 +506,7 @@ int ttm_bo_move_memcpy(struct ttm_buffer_object *bo,
 	int ret;
 	unsigned long i;
 	unsigned long page;
+	unsigned long run;
 	unsigned long add = 0;
 	int dir;
 
@@ -415,20 +555,34 @@ int ttm_bo_move_memcpy(struct ttm_buffer_object *bo,
 		add = new_mem->num_pages - 1;
 	}
 
-	for (i = 0; i < new_mem->num_pages; ++i) {
+	/*
+	 * Copy forward moves in runs of contiguous pages, overlapping moves
+	 * within one region have to go backwards page by page.
+	 */
+	for (i = 0; i < new_mem->num_pages; i += run) {
 		page = i * dir + add;
+		run = 1;
 		if (old_iomap == NULL) {
 			pgprot_t prot = ttm_io_prot(old_mem->placement,
 						    PAGE_KERNEL);
+			if (dir > 0)
+				run = ttm_tt_contig_pages(ttm, page,
+						new_mem->num_pages - i);
 			ret = ttm_copy_ttm_io_page(ttm, new_iomap, page,
-						   prot);
+						   run, prot);
 		} else if (new_iomap == NULL) {
 			pgprot_t prot = ttm_io_prot(new_mem->placement,
 						    PAGE_KERNEL);
+			if (dir > 0)
+				run = ttm_tt_contig_pages(ttm, page,
+						new_mem->num_pages - i);
 			ret = ttm_copy_io_ttm_page(ttm, old_iomap, page,
-						   prot);
+						   run, prot);
 		} else {
-			ret = ttm_copy_io_page(new_iomap, old_iomap, page);
+			if (dir > 0)
+				run = new_mem->num_pages - i;
+			ret = ttm_copy_io_page(new_iomap, old_iomap, page,
+					       run);
 		}
 		if (ret)
 			goto out1;
@@ -508,6 +662,7 @@ static int ttm_buffer_object_transfer(struct ttm_buffer_object *bo,
 	INIT_LIST_HEAD(&fbo->base.lru);
 	INIT_LIST_HEAD(&fbo->base.swap);
 	INIT_LIST_HEAD(&fbo->base.io_reserve_lru);
+	INIT_LIST_HEAD(&fbo->base.ddestroy_pending);
 	mutex_init(&fbo->base.wu_mutex);
 	fbo->base.moving = NULL;
 	drm_vma_node_reset(&fbo->base.base.vma_node);
@@ -44,6 +44,65 @@
 
 #define TTM_BO_VM_NUM_PREFAULT 16
 
+#ifdef __FreeBSD__
+#include <sys/counter.h>
+
+static SYSCTL_NODE(_hw_ttm, OID_AUTO, vm, CTLFLAG_RW | CTLFLAG_MPSAFE, 0,
+    "TTM CPU mappings");
+
+static counter_u64_t ttm_bo_vm_faults;
+static counter_u64_t ttm_bo_vm_pages;
+static counter_u64_t ttm_bo_vm_memattr_skipped;
+SYSCTL_COUNTER_U64(_hw_ttm_vm, OID_AUTO, faults, CTLFLAG_RD,
+    &ttm_bo_vm_faults, "CPU faults on buffer objects");
+SYSCTL_COUNTER_U64(_hw_ttm_vm, OID_AUTO, pages, CTLFLAG_RD,
+    &ttm_bo_vm_pages, "Pages mapped by faults, including prefaulted ones");
+SYSCTL_COUNTER_U64(_hw_ttm_vm, OID_AUTO, memattr_skipped, CTLFLAG_RD,
+    &ttm_bo_vm_memattr_skipped,
+    "Faulted pages that already had the right memory attribute");
+
+static void
+ttm_bo_vm_counters_init(void *arg __unused)
+{
+
+	ttm_bo_vm_faults = counter_u64_alloc(M_WAITOK);
+	ttm_bo_vm_pages = counter_u64_alloc(M_WAITOK);
+	ttm_bo_vm_memattr_skipped = counter_u64_alloc(M_WAITOK);
+}
+SYSINIT(ttm_bo_vm, SI_SUB_DRIVERS, SI_ORDER_ANY, ttm_bo_vm_counters_init,
+    NULL);
+
+static void
+ttm_bo_vm_counters_uninit(void *arg __unused)
+{
+
+	counter_u64_free(ttm_bo_vm_faults);
+	counter_u64_free(ttm_bo_vm_pages);
+	counter_u64_free(ttm_bo_vm_memattr_skipped);
+}
+SYSUNINIT(ttm_bo_vm, SI_SUB_DRIVERS, SI_ORDER_ANY, ttm_bo_vm_counters_uninit,
+    NULL);
+
+/*
+ * A fault right behind the previous prefault window doubles the window,
+ * up to the whole BO, so streaming through a mapping takes a logarithmic
+ * number of faults. Any other fault starts over at TTM_BO_VM_NUM_PREFAULT.
+ * Called with the BO reserved.
+ */
+static unsigned long
+ttm_bo_vm_prefault_window(struct ttm_buffer_object *bo,
+    unsigned long page_offset)
+{
+
+	if (bo->fault_window != 0 && page_offset == bo->fault_next)
+		bo->fault_window = min(bo->fault_window * 2, bo->num_pages);
+	else
+		bo->fault_window = TTM_BO_VM_NUM_PREFAULT;
+
+	return (bo->fault_window);
+}
+#endif
+
 static vm_fault_t ttm_bo_vm_fault_idle(struct ttm_buffer_object *bo,
 				struct vm_fault *vmf)
 {
@@ -298,14 +357,19 @@ static vm_fault_t ttm_bo_vm_fault(struct vm_area_struct *dummy, struct vm_fault
 #elif defined(__FreeBSD__)
 	vm_object_t obj;
 	vm_pindex_t pidx;
+	vm_memattr_t ma;
+	unsigned long count;
+	u64 skipped = 0;
 
 	ret = VM_FAULT_NOPAGE;
 	obj = vma->vm_obj;
+	ma = pgprot2cachemode(cvma.vm_page_prot);
+	count = ttm_bo_vm_prefault_window(bo, page_offset);
 	pidx = OFF_TO_IDX(address);
 	vma->vm_pfn_first = pidx;
 
 	VM_OBJECT_WLOCK(obj);
-	for (i = 0; i < TTM_BO_VM_NUM_PREFAULT && page_offset < page_last;
+	for (i = 0; i < count && page_offset < page_last;
 	    i++, page_offset++, pidx++) {
 retry:
 		page = vm_page_grab(obj, pidx, VM_ALLOC_NOCREAT);
@@ -327,8 +391,10 @@ retry:
 			}
 			vm_page_valid(page);
 		}
-		pmap_page_set_memattr(page,
-		    pgprot2cachemode(cvma.vm_page_prot));
+		if (pmap_page_get_memattr(page) != ma)
+			pmap_page_set_memattr(page, ma);
+		else
+			skipped++;
 		vma->vm_pfn_count++;
 		continue;
 fail:
@@ -337,6 +403,11 @@ fail:
 		break;
 	}
 	VM_OBJECT_WUNLOCK(obj);
+
+	bo->fault_next = page_offset;
+	counter_u64_add(ttm_bo_vm_faults, 1);
+	counter_u64_add(ttm_bo_vm_pages, vma->vm_pfn_count);
+	counter_u64_add(ttm_bo_vm_memattr_skipped, skipped);
 #endif
 out_io_unlock:
 	ttm_mem_io_unlock(man);
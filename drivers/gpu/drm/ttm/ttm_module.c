@@ -35,6 +35,11 @@
 #include <drm/ttm/ttm_module.h>
 #include <drm/drm_sysfs.h>
 
+#ifdef __FreeBSD__
+SYSCTL_NODE(_hw, OID_AUTO, ttm, CTLFLAG_RW | CTLFLAG_MPSAFE, 0,
+    "TTM memory manager");
+#endif
+
 static DECLARE_WAIT_QUEUE_HEAD(exit_q);
 static atomic_t device_released;
 
@@ -58,6 +58,29 @@
 #define FREE_ALL_PAGES			(~0U)
 /* times are in msecs */
 #define PAGE_FREE_INTERVAL		1000
+/* per-cpu cache size and the batch it refills and drains with */
+#define TTM_PCP_SIZE			NUM_PAGES_TO_ALLOC
+#define TTM_PCP_BATCH			(TTM_PCP_SIZE / 2)
+
+/**
+ * struct ttm_page_pool_pcp - Per-cpu cache in front of a pool.
+ *
+ * Small allocations and frees go through the cache of the cpu they run on,
+ * which only exchanges pages with the shared pool TTM_PCP_BATCH at a time.
+ * This keeps the pool lock out of the path of most populate and unpopulate
+ * calls. Pages in the cache are still owned by the pool: the shrinker
+ * counts them and drains the caches back before freeing pool pages.
+ *
+ * @lock: Protects the cache. Only contended when the shrinker drains it or
+ * when a thread migrated while using it. Nests outside of the pool lock.
+ * @npages: Number of pages in the cache.
+ * @pages: The cached pages, most recently freed last.
+ */
+struct ttm_page_pool_pcp {
+	spinlock_t		lock;
+	unsigned		npages;
+	struct page		*pages[TTM_PCP_SIZE];
+} ____cacheline_aligned;
 
 /**
  * struct ttm_page_pool - Pool to reuse recently allocated uc/wc pages.
@@ -69,6 +92,8 @@
  * @list: Pool of free uc/wc pages for fast reuse.
  * @gfp_flags: Flags to pass for alloc_page.
  * @npages: Number of pages in pool.
+ * @pcp: Per-cpu caches, only for order 0 pools.
+ * @pcp_hits: Allocations served from a per-cpu cache.
  */
 struct ttm_page_pool {
 	spinlock_t		lock;
@@ -84,6 +109,8 @@ struct ttm_page_pool {
 	unsigned long		nfrees;
 	unsigned long		nrefills;
 	unsigned int		order;
+	struct ttm_page_pool_pcp *pcp;
+	atomic_long_t		pcp_hits;
 };
 
 /**
@@ -155,6 +182,10 @@ static void ttm_pool_kobj_release(struct kobject *kobj)
 {
 	struct ttm_pool_manager *m =
 		container_of(kobj, struct ttm_pool_manager, kobj);
+	unsigned i;
+
+	for (i = 0; i < NUM_POOLS; ++i)
+		kfree(m->pools[i].pcp);
 	kfree(m);
 }
 
@@ -278,6 +309,169 @@ static void ttm_pool_update_free_locked(struct ttm_page_pool *pool,
 	pool->nfrees += freed_pages;
 }
 
+/* Move up to count pages from the head of the pool to pages. */
+static unsigned ttm_page_pool_take_locked(struct ttm_page_pool *pool,
+					  struct page **pages, unsigned count)
+{
+	struct page *p;
+	unsigned i;
+
+	count = min(count, pool->npages);
+	for (i = 0; i < count; ++i) {
+#ifdef __linux__
+		p = list_first_entry(&pool->list, struct page, lru);
+		list_del(&p->lru);
+#elif defined(__FreeBSD__)
+		p = TAILQ_FIRST(&pool->list);
+		TAILQ_REMOVE(&pool->list, p, plinks.q);
+#endif
+		pages[i] = p;
+	}
+	pool->npages -= count;
+	return count;
+}
+
+/* Move count pages to the tail of the pool. */
+static void ttm_page_pool_give_locked(struct ttm_page_pool *pool,
+				      struct page **pages, unsigned count)
+{
+	unsigned i;
+
+	for (i = 0; i < count; ++i) {
+#ifdef __linux__
+		list_add_tail(&pages[i]->lru, &pool->list);
+#elif defined(__FreeBSD__)
+		TAILQ_INSERT_TAIL(&pool->list, pages[i], plinks.q);
+#endif
+	}
+	pool->npages += count;
+}
+
+static struct ttm_page_pool_pcp *ttm_pool_pcp(struct ttm_page_pool *pool)
+{
+	return &pool->pcp[raw_smp_processor_id()];
+}
+
+/**
+ * Allocate npages pages from the per-cpu cache, refilling it from the pool
+ * if needed. The cache is left alone if it can't satisfy the request.
+ *
+ * @return true if all npages pages were allocated.
+ */
+static bool ttm_pool_pcp_get(struct ttm_page_pool *pool, struct page **pages,
+			     unsigned npages, int flags)
+{
+	struct ttm_page_pool_pcp *pcp = ttm_pool_pcp(pool);
+	unsigned long irq_flags;
+	unsigned i;
+
+	spin_lock_irqsave(&pcp->lock, irq_flags);
+	if (pcp->npages < npages) {
+		spin_lock(&pool->lock);
+		pcp->npages += ttm_page_pool_take_locked(pool,
+			&pcp->pages[pcp->npages],
+			min_t(unsigned, TTM_PCP_BATCH,
+			      TTM_PCP_SIZE - pcp->npages));
+		spin_unlock(&pool->lock);
+	}
+	if (pcp->npages < npages) {
+		spin_unlock_irqrestore(&pcp->lock, irq_flags);
+		return false;
+	}
+	pcp->npages -= npages;
+	memcpy(pages, &pcp->pages[pcp->npages], npages * sizeof(*pages));
+	spin_unlock_irqrestore(&pcp->lock, irq_flags);
+
+	atomic_long_add(npages, &pool->pcp_hits);
+
+	if (flags & TTM_PAGE_FLAG_ZERO_ALLOC) {
+		for (i = 0; i < npages; ++i) {
+#ifdef __linux__
+			if (PageHighMem(pages[i]))
+				clear_highpage(pages[i]);
+			else
+				clear_page(page_address(pages[i]));
+#elif defined(__FreeBSD__)
+			pmap_zero_page(pages[i]);
+#endif
+		}
+	}
+	return true;
+}
+
+/**
+ * Free the non NULL pages in pages to the per-cpu cache, draining the
+ * oldest ones to the pool when the cache is full.
+ *
+ * @return true if pages were drained to the pool.
+ */
+static bool ttm_pool_pcp_put(struct ttm_page_pool *pool, struct page **pages,
+			     unsigned npages)
+{
+	struct ttm_page_pool_pcp *pcp = ttm_pool_pcp(pool);
+	unsigned long irq_flags;
+	bool drained = false;
+	unsigned i;
+
+	spin_lock_irqsave(&pcp->lock, irq_flags);
+	for (i = 0; i < npages; ++i) {
+		if (!pages[i])
+			continue;
+		if (page_count(pages[i]) != 1)
+			pr_err("Erroneous page count. Leaking pages.\n");
+		if (pcp->npages == TTM_PCP_SIZE) {
+			spin_lock(&pool->lock);
+			ttm_page_pool_give_locked(pool, pcp->pages,
+						  TTM_PCP_BATCH);
+			spin_unlock(&pool->lock);
+			pcp->npages -= TTM_PCP_BATCH;
+			memmove(pcp->pages, &pcp->pages[TTM_PCP_BATCH],
+				pcp->npages * sizeof(pcp->pages[0]));
+			drained = true;
+		}
+		pcp->pages[pcp->npages++] = pages[i];
+		pages[i] = NULL;
+	}
+	spin_unlock_irqrestore(&pcp->lock, irq_flags);
+	return drained;
+}
+
+/* Return the pages of all per-cpu caches to the pool. */
+static void ttm_pool_pcp_drain(struct ttm_page_pool *pool)
+{
+	struct ttm_page_pool_pcp *pcp;
+	unsigned long irq_flags;
+	unsigned cpu;
+
+	if (!pool->pcp)
+		return;
+
+	for (cpu = 0; cpu < nr_cpu_ids; ++cpu) {
+		pcp = &pool->pcp[cpu];
+		if (!READ_ONCE(pcp->npages))
+			continue;
+
+		spin_lock_irqsave(&pcp->lock, irq_flags);
+		spin_lock(&pool->lock);
+		ttm_page_pool_give_locked(pool, pcp->pages, pcp->npages);
+		spin_unlock(&pool->lock);
+		pcp->npages = 0;
+		spin_unlock_irqrestore(&pcp->lock, irq_flags);
+	}
+}
+
+static unsigned ttm_pool_pcp_count(struct ttm_page_pool *pool)
+{
+	unsigned cpu, count = 0;
+
+	if (!pool->pcp)
+		return 0;
+
+	for (cpu = 0; cpu < nr_cpu_ids; ++cpu)
+		count += READ_ONCE(pool->pcp[cpu].npages);
+	return count;
+}
+
 /**
  * Free pages from pool.
  *
@@ -425,6 +619,7 @@ ttm_pool_shrink_scan(struct shrinker *shrink, struct shrink_control *sc)
 			break;
 
 		pool = &_manager->pools[(i + pool_offset)%NUM_POOLS];
+		ttm_pool_pcp_drain(pool);
 		page_nr = (1 << pool->order);
 		/* OK to use static buffer since global mutex is held. */
 		nr_free_pool = roundup(nr_free, page_nr) >> pool->order;
@@ -448,7 +643,7 @@ ttm_pool_shrink_count(struct shrinker *shrink, struct shrink_control *sc)
 
 	for (i = 0; i < NUM_POOLS; ++i) {
 		pool = &_manager->pools[i];
-		count += (pool->npages << pool->order);
+		count += (pool->npages + ttm_pool_pcp_count(pool)) << pool->order;
 	}
 
 	return count;
@@ -884,6 +1079,13 @@ static void ttm_put_pages(struct page **pages, unsigned npages, int flags,
 	}
 #endif
 
+	if (npages - i <= TTM_PCP_BATCH) {
+		/* Only check the pool limit if the cache drained to it */
+		if (!ttm_pool_pcp_put(pool, &pages[i], npages - i))
+			return;
+		i = npages;
+	}
+
 	spin_lock_irqsave(&pool->lock, irq_flags);
 	while (i < npages) {
 		if (pages[i]) {
@@ -993,6 +1195,10 @@ static int ttm_get_pages(struct page **pages, unsigned npages, int flags,
 		return 0;
 	}
 
+	/* Small allocations are served from the per-cpu cache */
+	if (npages <= TTM_PCP_BATCH && ttm_pool_pcp_get(pool, pages, npages, flags))
+		return 0;
+
 	/* First we take pages from the pool */
 #ifdef __linux__
 	count = 0;
@@ -1068,10 +1274,25 @@ static void ttm_page_pool_init_locked(struct ttm_page_pool *pool, gfp_t flags,
 	pool->gfp_flags = flags;
 	pool->name = name;
 	pool->order = order;
+	atomic_long_set(&pool->pcp_hits, 0);
+}
+
+static int ttm_page_pool_init_pcp(struct ttm_page_pool *pool)
+{
+	unsigned cpu;
+
+	pool->pcp = kcalloc(nr_cpu_ids, sizeof(*pool->pcp), GFP_KERNEL);
+	if (!pool->pcp)
+		return -ENOMEM;
+
+	for (cpu = 0; cpu < nr_cpu_ids; ++cpu)
+		spin_lock_init(&pool->pcp[cpu].lock);
+	return 0;
 }
 
 int ttm_page_alloc_init(struct ttm_mem_global *glob, unsigned max_pages)
 {
+	unsigned i;
 	int ret;
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 	unsigned order = HPAGE_PMD_ORDER;
@@ -1113,6 +1334,21 @@ int ttm_page_alloc_init(struct ttm_mem_global *glob, unsigned max_pages)
 	_manager->options.small = SMALL_ALLOCATION;
 	_manager->options.alloc_size = NUM_PAGES_TO_ALLOC;
 
+	ret = ttm_page_pool_init_pcp(&_manager->wc_pool);
+	if (!ret)
+		ret = ttm_page_pool_init_pcp(&_manager->uc_pool);
+	if (!ret)
+		ret = ttm_page_pool_init_pcp(&_manager->wc_pool_dma32);
+	if (!ret)
+		ret = ttm_page_pool_init_pcp(&_manager->uc_pool_dma32);
+	if (unlikely(ret != 0)) {
+		for (i = 0; i < NUM_POOLS; ++i)
+			kfree(_manager->pools[i].pcp);
+		kfree(_manager);
+		_manager = NULL;
+		return ret;
+	}
+
 	ret = kobject_init_and_add(&_manager->kobj, &ttm_pool_kobj_type,
 				   &glob->kobj, "pool");
 	if (unlikely(ret != 0))
@@ -1137,8 +1373,10 @@ void ttm_page_alloc_fini(void)
 	ttm_pool_mm_shrink_fini(_manager);
 
 	/* OK to use static buffer since global mutex is no longer used. */
-	for (i = 0; i < NUM_POOLS; ++i)
+	for (i = 0; i < NUM_POOLS; ++i) {
+		ttm_pool_pcp_drain(&_manager->pools[i]);
 		ttm_page_pool_free(&_manager->pools[i], FREE_ALL_PAGES, true);
+	}
 
 	kobject_put(&_manager->kobj);
 	_manager = NULL;
@@ -1289,19 +1527,21 @@ int ttm_page_alloc_debugfs(struct seq_file *m, void *data)
 {
 	struct ttm_page_pool *p;
 	unsigned i;
-	char *h[] = {"pool", "refills", "pages freed", "size"};
+	char *h[] = {"pool", "refills", "pages freed", "size", "cpu cached",
+		     "cpu hits"};
 	if (!_manager) {
 		seq_printf(m, "No pool allocator running.\n");
 		return 0;
 	}
-	seq_printf(m, "%7s %12s %13s %8s\n",
-			h[0], h[1], h[2], h[3]);
+	seq_printf(m, "%7s %12s %13s %8s %10s %12s\n",
+			h[0], h[1], h[2], h[3], h[4], h[5]);
 	for (i = 0; i < NUM_POOLS; ++i) {
 		p = &_manager->pools[i];
 
-		seq_printf(m, "%7s %12ld %13ld %8d\n",
+		seq_printf(m, "%7s %12ld %13ld %8d %10u %12ld\n",
 				p->name, p->nrefills,
-				p->nfrees, p->npages);
+				p->nfrees, p->npages, ttm_pool_pcp_count(p),
+				atomic_long_read(&p->pcp_hits));
 	}
 	return 0;
 }
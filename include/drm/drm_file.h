@@ -266,8 +266,18 @@ struct drm_file {
 
 	/** @syncobj_idr: Mapping of sync object handles to object pointers. */
 	struct idr syncobj_idr;
-	/** @syncobj_table_lock: Protects @syncobj_idr. */
+	/**
+	 * @syncobj_table_lock: Protects @syncobj_idr and
+	 * @syncobj_wait_pool.
+	 */
 	spinlock_t syncobj_table_lock;
+	/**
+	 * @syncobj_wait_pool: Cached wait state of syncobj array waits, so
+	 * waits don't need to allocate it every time.
+	 */
+	struct list_head syncobj_wait_pool;
+	/** @syncobj_wait_pool_count: Number of entries in @syncobj_wait_pool. */
+	unsigned int syncobj_wait_pool_count;
 
 	/** @filp: Pointer to the core file structure. */
 	struct file *filp;
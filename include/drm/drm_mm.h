@@ -72,6 +72,11 @@ enum drm_mm_insert_mode {
 	 * Search for the smallest hole (within the search range) that fits
 	 * the desired node.
 	 *
+	 * If drm_mm_enable_size_classes() was called, a few holes from the
+	 * smallest size class that is guaranteed to fit are tried first, so
+	 * the chosen hole may be up to an eighth larger than the smallest
+	 * one.
+	 *
 	 * Allocates the node from the bottom of the found hole.
 	 */
 	DRM_MM_INSERT_BEST = 0,
@@ -163,6 +168,7 @@ struct drm_mm_node {
 	struct drm_mm *mm;
 	struct list_head node_list;
 	struct list_head hole_stack;
+	struct list_head hole_class;
 	struct rb_node rb;
 	struct rb_node rb_hole_size;
 	struct rb_node rb_hole_addr;
@@ -175,6 +181,55 @@ struct drm_mm_node {
 #endif
 };
 
+/**
+ * struct drm_mm_stats - DRM allocator operation counters
+ *
+ * Cumulative counters maintained by the range allocator since drm_mm_init().
+ * They are serialised by the same driver lock that protects the allocator
+ * itself and are reported by drm_mm_print_stats(), so that changes to the
+ * search and eviction algorithms can be measured on a live system.
+ */
+struct drm_mm_stats {
+	/** @insert: Successful drm_mm_insert_node_in_range() calls. */
+	u64 insert;
+	/** @insert_fail: drm_mm_insert_node_in_range() calls returning -ENOSPC. */
+	u64 insert_fail;
+	/**
+	 * @insert_search: drm_mm_insert_node_in_range() calls that searched the
+	 * hole trees, i.e. all calls except those rejected up front because no
+	 * hole is large enough. @insert_holes and @insert_ns are accounted for
+	 * these calls only.
+	 */
+	u64 insert_search;
+	/**
+	 * @insert_class: Successful inserts that were satisfied from the size
+	 * class index, see drm_mm_enable_size_classes().
+	 */
+	u64 insert_class;
+	/** @insert_holes: Holes inspected by all drm_mm_insert_node_in_range() calls. */
+	u64 insert_holes;
+	/**
+	 * @insert_ns: Time spent in drm_mm_insert_node_in_range(). Only
+	 * accounted with CONFIG_DRM_DEBUG_MM.
+	 */
+	u64 insert_ns;
+	/** @reserve: Successful drm_mm_reserve_node() calls. */
+	u64 reserve;
+	/** @remove: drm_mm_remove_node() calls. */
+	u64 remove;
+	/**
+	 * @remove_ns: Time spent in drm_mm_remove_node(). Only accounted with
+	 * CONFIG_DRM_DEBUG_MM.
+	 */
+	u64 remove_ns;
+	/** @scan_add: Nodes added to an eviction scan. */
+	u64 scan_add;
+	/** @scan_evict: Nodes selected for eviction by an eviction scan. */
+	u64 scan_evict;
+};
+
+struct drm_mm_hole_classes;
+
 /**
  * struct drm_mm - DRM allocator
  *
@@ -207,8 +262,13 @@ struct drm_mm {
 	struct rb_root_cached interval_tree;
 	struct rb_root_cached holes_size;
 	struct rb_root holes_addr;
+	/* Optional segregated-fit index, see drm_mm_enable_size_classes(). */
+	struct drm_mm_hole_classes *hole_classes;
 
 	unsigned long scan_active;
+
+	/* Operation counters, see drm_mm_print_stats(). */
+	struct drm_mm_stats stats;
 };
 
 /**
@@ -238,6 +298,23 @@ struct drm_mm_scan {
 	enum drm_mm_insert_mode mode;
 };
 
+/**
+ * struct drm_mm_scan_candidate - eviction candidate for drm_mm_scan_batch()
+ *
+ * Drivers fill in an array of these, typically on the stack or in a
+ * preallocated buffer, with every node they are willing to evict.
+ */
+struct drm_mm_scan_candidate {
+	/** @node: Allocated node that may be evicted. */
+	struct drm_mm_node *node;
+	/**
+	 * @cost: Driver defined cost of evicting @node, e.g. its size scaled
+	 * up for busy nodes. The sum of the costs of all candidates must not
+	 * overflow.
+	 */
+	u64 cost;
+};
+
 /**
  * drm_mm_node_allocated - checks whether a node is allocated
  * @node: drm_mm_node to check
@@ -461,6 +538,7 @@ static inline int drm_mm_insert_node(struct drm_mm *mm,
 void drm_mm_remove_node(struct drm_mm_node *node);
 void drm_mm_replace_node(struct drm_mm_node *old, struct drm_mm_node *new);
 void drm_mm_init(struct drm_mm *mm, u64 start, u64 size);
+int drm_mm_enable_size_classes(struct drm_mm *mm);
 void drm_mm_takedown(struct drm_mm *mm);
 
 /**
@@ -542,8 +620,13 @@ bool drm_mm_scan_add_block(struct drm_mm_scan *scan,
 			   struct drm_mm_node *node);
 bool drm_mm_scan_remove_block(struct drm_mm_scan *scan,
 			      struct drm_mm_node *node);
+int drm_mm_scan_batch(struct drm_mm_scan *scan,
+		      struct drm_mm_scan_candidate *candidates,
+		      unsigned int count,
+		      unsigned int *first);
 struct drm_mm_node *drm_mm_scan_color_evict(struct drm_mm_scan *scan);
 
 void drm_mm_print(const struct drm_mm *mm, struct drm_printer *p);
+void drm_mm_print_stats(const struct drm_mm *mm, struct drm_printer *p);
 
 #endif
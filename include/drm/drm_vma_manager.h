@@ -226,11 +226,12 @@ static inline void drm_vma_node_unmap(struct drm_vma_offset_node *node,
 	if (drm_mm_node_allocated(&node->vm_node))
 #ifdef __linux__
 		unmap_mapping_range(file_mapping,
-#elif defined(__FreeBSD__)
-		unmap_mapping_range(obj,
-#endif
 				    drm_vma_node_offset_addr(node),
 				    drm_vma_node_size(node) << PAGE_SHIFT, 1);
+#elif defined(__FreeBSD__)
+		unmap_mapping_range(obj, 0,
+				    drm_vma_node_size(node) << PAGE_SHIFT, 1);
+#endif
 }
 
 /**
@@ -26,6 +26,8 @@
 
 #include <drm/spsc_queue.h>
 #include <linux/dma-fence.h>
+#include <linux/kref.h>
+#include <linux/rbtree.h>
 
 #ifdef __FreeBSD__
 #include <linux/workqueue.h>
@@ -48,6 +50,35 @@ enum drm_sched_priority {
 	DRM_SCHED_PRIORITY_UNSET = -2
 };
 
+/**
+ * enum drm_sched_policy - how a run queue picks the next entity
+ *
+ * @DRM_SCHED_POLICY_RR: round robin over all entities of the run queue.
+ * @DRM_SCHED_POLICY_FAIR: entities with queued jobs are kept sorted by the
+ *                         GPU time they consumed, the least served ready
+ *                         entity runs next.
+ */
+enum drm_sched_policy {
+	DRM_SCHED_POLICY_RR,
+	DRM_SCHED_POLICY_FAIR,
+	DRM_SCHED_POLICY_COUNT
+};
+
+/**
+ * struct drm_sched_entity_stats - GPU time accounting of an entity
+ *
+ * @refcount: held by the entity and by each &drm_sched_fence it created,
+ *            so jobs can still be charged after the entity is gone.
+ * @runtime: nanoseconds the entity's jobs occupied the hardware ring.
+ * @avg_job: decaying average of @runtime per job, the estimated cost of the
+ *           entity's next job.
+ */
+struct drm_sched_entity_stats {
+	struct kref			refcount;
+	atomic64_t			runtime;
+	atomic64_t			avg_job;
+};
+
 /**
  * struct drm_sched_entity - A wrapper around a job queue (typically
  * attached to the DRM file_priv).
@@ -75,6 +106,12 @@ enum drm_sched_priority {
  * @last_scheduled: points to the finished fence of the last scheduled job.
  * @last_user: last group leader pushing a job into the entity.
  * @stopped: Marks the enity as removed from rq and destined for termination.
+ * @rb_node: position in &drm_sched_rq.rb_tree while jobs are queued, only
+ *           used by the fair policy.
+ * @vruntime: sort key in &drm_sched_rq.rb_tree.
+ * @vruntime_offset: added to the consumed runtime to compute @vruntime, so
+ *                   an entity which was idle does not starve the others.
+ * @stats: GPU time consumed by this entity.
  *
  * Entities will emit jobs in order to their corresponding hardware
  * ring, and the scheduler will alternate between entities based on
@@ -98,6 +135,11 @@ struct drm_sched_entity {
 	struct dma_fence                *last_scheduled;
 	struct task_struct		*last_user;
 	bool 				stopped;
+
+	struct rb_node			rb_node;
+	u64				vruntime;
+	u64				vruntime_offset;
+	struct drm_sched_entity_stats	*stats;
 };
 
 /**
@@ -107,6 +149,9 @@ struct drm_sched_entity {
  * @sched: the scheduler to which this rq belongs to.
  * @entities: list of the entities to be scheduled.
  * @current_entity: the entity which is to be scheduled.
+ * @rb_tree: entities with queued jobs sorted by vruntime (fair policy).
+ * @min_vruntime: monotonic lower bound for the vruntime of entities entering
+ *                @rb_tree.
  *
  * Run queue is a set of entities scheduling command submissions for
  * one specific ring. It implements the scheduling policy that selects
@@ -117,6 +162,8 @@ struct drm_sched_rq {
 	struct drm_gpu_scheduler	*sched;
 	struct list_head		entities;
 	struct drm_sched_entity		*current_entity;
+	struct rb_root_cached		rb_tree;
+	u64				min_vruntime;
 };
 
 /**
@@ -160,6 +207,15 @@ struct drm_sched_fence {
          * @owner: job owner for debugging
          */
 	void				*owner;
+        /**
+         * @stats: the entity accounting the job's runtime is charged to.
+         */
+	struct drm_sched_entity_stats	*stats;
+        /**
+         * @cost: estimated runtime accounted in
+         * &drm_gpu_scheduler.pending_cost until the job finishes.
+         */
+	u64				cost;
 };
 
 struct drm_sched_fence *to_drm_sched_fence(struct dma_fence *f);
@@ -257,6 +313,10 @@ struct drm_sched_backend_ops {
  * @work_tdr: schedules a delayed call to @drm_sched_job_timedout after the
  *            timeout interval is over.
  * @thread: the kthread on which the scheduler which run.
+ * @work_run: work item running the scheduler on the shared worker pool
+ *            instead of @thread.
+ * @use_wq: the scheduler runs from @work_run.
+ * @paused: @work_run is parked, see drm_sched_park().
  * @ring_mirror_list: the list of jobs which are currently in the job queue.
  * @job_list_lock: lock to protect the ring_mirror_list.
  * @hang_limit: once the hangs by a job crosses this limit then it is marked
@@ -264,6 +324,14 @@ struct drm_sched_backend_ops {
  * @num_jobs: the number of jobs in queue in the scheduler
  * @ready: marks if the underlying HW is ready to work
  * @free_guilty: A hit to time out handler to free the guilty job.
+ * @policy: entity selection policy of the run queues.
+ * @last_finished: completion time of the last job, jobs only get charged for
+ *                 the time after the previous job on the ring finished.
+ * @pending_cost: estimated runtime in ns of the pushed but unfinished jobs,
+ *                used to balance entities between schedulers.
+ * @busy_time: total runtime in ns charged for jobs on this scheduler.
+ * @avg_job: decaying average runtime of a job on this scheduler, the cost
+ *           estimate for entities without history.
  *
  * One scheduler is implemented for each hardware ring.
  */
@@ -279,12 +347,20 @@ struct drm_gpu_scheduler {
 	atomic64_t			job_id_count;
 	struct delayed_work		work_tdr;
 	struct task_struct		*thread;
+	struct work_struct		work_run;
+	bool				use_wq;
+	bool				paused;
 	struct list_head		ring_mirror_list;
 	spinlock_t			job_list_lock;
 	int				hang_limit;
 	atomic_t                        num_jobs;
 	bool			ready;
 	bool				free_guilty;
+	enum drm_sched_policy		policy;
+	ktime_t				last_finished;
+	atomic64_t			pending_cost;
+	atomic64_t			busy_time;
+	atomic64_t			avg_job;
 };
 
 int drm_sched_init(struct drm_gpu_scheduler *sched,
@@ -293,6 +369,21 @@ int drm_sched_init(struct drm_gpu_scheduler *sched,
 		   const char *name);
 
 void drm_sched_fini(struct drm_gpu_scheduler *sched);
+void drm_sched_park(struct drm_gpu_scheduler *sched);
+void drm_sched_unpark(struct drm_gpu_scheduler *sched);
+
+/**
+ * drm_sched_has_worker - check if the scheduler was started
+ *
+ * @sched: scheduler instance
+ *
+ * Returns true once drm_sched_init() created the kthread or set up the
+ * work item that submits jobs for this scheduler.
+ */
+static inline bool drm_sched_has_worker(struct drm_gpu_scheduler *sched)
+{
+	return sched->thread != NULL || sched->use_wq;
+}
 int drm_sched_job_init(struct drm_sched_job *job,
 		       struct drm_sched_entity *entity,
 		       void *owner);
@@ -311,6 +402,35 @@ void drm_sched_rq_add_entity(struct drm_sched_rq *rq,
 			     struct drm_sched_entity *entity);
 void drm_sched_rq_remove_entity(struct drm_sched_rq *rq,
 				struct drm_sched_entity *entity);
+void drm_sched_rq_update_entity(struct drm_sched_rq *rq,
+				struct drm_sched_entity *entity);
+
+void drm_sched_entity_stats_release(struct kref *kref);
+
+static inline struct drm_sched_entity_stats *
+drm_sched_entity_stats_get(struct drm_sched_entity_stats *stats)
+{
+	kref_get(&stats->refcount);
+	return stats;
+}
+
+/*
+ * Decay an average by 1/8 per sample. Concurrent updates may lose a sample,
+ * which is fine for an estimate.
+ */
+static inline void drm_sched_avg_update(atomic64_t *avg, u64 sample)
+{
+	s64 old = atomic64_read(avg);
+
+	atomic64_set(avg, old ? old + ((s64)sample - old) / 8 : (s64)sample);
+}
+
+static inline void
+drm_sched_entity_stats_put(struct drm_sched_entity_stats *stats)
+{
+	if (stats)
+		kref_put(&stats->refcount, drm_sched_entity_stats_release);
+}
 
 int drm_sched_entity_init(struct drm_sched_entity *entity,
 			  struct drm_sched_rq **rq_list,
@@ -41,6 +41,8 @@
 #include <linux/mm.h>
 #include <linux/bitmap.h>
 #include <linux/dma-resv.h>
+#include <linux/dma-fence.h>
+#include <linux/llist.h>
 
 struct ttm_bo_global;
 
@@ -147,15 +149,24 @@ struct ttm_tt;
  * holds a pointer to a persistent shmem object.
  * @ttm: TTM structure holding system pages.
  * @evicted: Whether the object was evicted without user-space knowing.
+ * @refaults: Number of times the object was moved back after an eviction.
  * @cpu_writes: For synchronization. Number of cpu writers.
  * @lru: List head for the lru list.
  * @ddestroy: List head for the delayed destroy list.
  * @swap: List head for swap LRU list.
+ * @lru_jiffies: When the object was last added to an LRU list.
+ * @ddestroy_fence: Fence whose signaling queues the object for destruction.
+ * @ddestroy_cb: Callback on @ddestroy_fence.
+ * @ddestroy_node: Entry on the device's list of objects ready to destroy.
+ * @ddestroy_pending: Entry on the device's list of objects with a pending
+ * delayed destroy callback.
  * @moving: Fence set when BO is moving
  * @offset: The current GPU offset, which can have different meanings
  * depending on the memory type. For SYSTEM type memory, it should be 0.
  * @cur_placement: Hint of current placement.
  * @wu_mutex: Wait unreserved mutex.
+ * @fault_next: Page offset following the last CPU fault's prefault window.
+ * @fault_window: Current prefault window, grows on sequential CPU faults.
  *
  * Base class for TTM buffer object, that deals with data placement and CPU
  * mappings. GPU mappings are really up to the driver, but for simpler GPUs
@@ -197,6 +208,7 @@ struct ttm_buffer_object {
 	struct file *persistent_swap_storage;
 	struct ttm_tt *ttm;
 	bool evicted;
+	unsigned refaults;
 
 	/**
 	 * Members protected by the bo::reserved lock only when written to.
@@ -212,6 +224,16 @@ struct ttm_buffer_object {
 	struct list_head ddestroy;
 	struct list_head swap;
 	struct list_head io_reserve_lru;
+	unsigned long lru_jiffies;
+
+	/**
+	 * Members owned by the delayed destroy fence callback.
+	 */
+
+	struct dma_fence *ddestroy_fence;
+	struct dma_fence_cb ddestroy_cb;
+	struct llist_node ddestroy_node;
+	struct list_head ddestroy_pending;
 
 	/**
 	 * Members protected by a bo reservation.
@@ -219,6 +241,10 @@ struct ttm_buffer_object {
 
 	struct dma_fence *moving;
 	unsigned priority;
+#ifdef __FreeBSD__
+	unsigned long fault_next;
+	unsigned long fault_window;
+#endif
 
 	/**
 	 * Special members that are protected by the reserve lock
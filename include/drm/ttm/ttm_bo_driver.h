@@ -170,6 +170,8 @@ struct ttm_mem_type_manager_func {
  * static information. bdev::driver::io_mem_free is never used.
  * @lru: The lru list for this memory type.
  * @move: The fence of the last pipelined move operation.
+ * @evict_bytes: Bytes moved by the last evacuation of this memory type.
+ * @evict_us: Wall time of the last evacuation of this memory type.
  *
  * This structure is used to identify and manage memory types for a device.
  * It's set up by the ttm_bo_driver::init_mem_type method.
@@ -214,6 +216,13 @@ struct ttm_mem_type_manager {
 	 * Protected by @move_lock.
 	 */
 	struct dma_fence *move;
+
+	/*
+	 * Written by ttm_bo_evict_mm() and ttm_bo_clean_mm(), which the
+	 * driver serializes.
+	 */
+	uint64_t evict_bytes;
+	uint64_t evict_us;
 };
 
 /**
@@ -457,6 +466,20 @@ extern struct ttm_bo_global {
 
 #define TTM_NUM_MEM_TYPES 8
 
+/**
+ * enum ttm_bo_evict_policy - How a victim is chosen when a memory type is full
+ *
+ * @TTM_EVICT_LRU: The least recently used evictable BO.
+ * @TTM_EVICT_SCORED: The best of the least recently used evictable BOs,
+ * scored by idle time, size fit, busy state and how often it came back
+ * after earlier evictions.
+ */
+enum ttm_bo_evict_policy {
+	TTM_EVICT_LRU,
+	TTM_EVICT_SCORED,
+	TTM_EVICT_COUNT,
+};
+
 /**
  * struct ttm_bo_device - Buffer object driver device-specific data.
  *
@@ -468,7 +491,16 @@ extern struct ttm_bo_global {
  * @dev_mapping: A pointer to the struct address_space representing the
  * device address space.
  * @wq: Work queue structure for the delayed delete workqueue.
+ * @ddestroy_async: BOs waiting for a fence callback to destroy them.
+ * @ddestroy_ready: BOs whose fence callback fired.
+ * @ddestroy_work: Destroys the BOs on @ddestroy_ready in batches.
+ * @ddestroy_lock: Protects @ddestroy_pending.
+ * @ddestroy_pending: BOs referenced by @ddestroy_work or a fence callback.
+ * @ddestroy_paused: Set while the delayed workqueue is locked.
  * @no_retry: Don't retry allocation if it fails
+ * @evict_policy: The eviction policy used by this device. Set from
+ * the ttm evict_policy parameter at init, drivers may change it before the
+ * first allocation.
  *
  */
 
@@ -494,6 +526,7 @@ struct ttm_bo_device {
 	 * Protected by the global:lru lock.
 	 */
 	struct list_head ddestroy;
+	struct list_head ddestroy_async;
 
 #ifdef __linux__
 	/*
@@ -508,10 +541,17 @@ struct ttm_bo_device {
 	 */
 
 	struct delayed_work wq;
+	struct llist_head ddestroy_ready;
+	struct work_struct ddestroy_work;
+	spinlock_t ddestroy_lock;
+	struct list_head ddestroy_pending;
+	bool ddestroy_paused;
 
 	bool need_dma32;
 
 	bool no_retry;
+
+	enum ttm_bo_evict_policy evict_policy;
 };
 
 /**
@@ -34,6 +34,12 @@
 #include <linux/kernel.h>
 struct kobject;
 
+#ifdef __FreeBSD__
+#include <sys/sysctl.h>
+
+SYSCTL_DECL(_hw_ttm);
+#endif
+
 #define TTM_PFX "[TTM] "
 extern struct kobject *ttm_get_kobj(void);
 
@@ -25,6 +25,12 @@
 #ifndef _LINUX_GPLV2_DMA_BUF_H_
 #define _LINUX_GPLV2_DMA_BUF_H_
 
+#include <sys/param.h>
+#include <sys/_lock.h>
+#include <sys/_mutex.h>
+#include <sys/selinfo.h>
+#include <sys/_task.h>
+
 #include <linux/file.h>
 #include <linux/err.h>
 #include <linux/scatterlist.h>
@@ -112,12 +118,15 @@ struct dma_buf {
 	void *priv;
 	struct dma_resv *resv;
 
-	/* poll support */
-	wait_queue_head_t poll;
+	/* poll and kqueue support, poll_mtx also locks the knlist */
+	struct mtx poll_mtx;
+	struct selinfo poll_sel;
+	struct task poll_task;
 
 	struct dma_buf_poll_cb_t {
 		struct dma_fence_cb cb;
-		wait_queue_head_t *poll;
+		struct dma_buf *db;
+		struct dma_fence *fence;	/* last fence waited on */
 
 		unsigned long active;
 	} cb_excl, cb_shared;
@@ -22,6 +22,8 @@
  * @fence: encapsulated fence
  * @cb: callback structure for signaling
  * @work: irq work item for signaling
+ * @skip: referenced older node of the same timeline, used to speed up lookups
+ * @depth: number of older nodes of the same timeline when created
  */
 struct dma_fence_chain {
 	struct dma_fence base;
@@ -31,6 +33,8 @@ struct dma_fence_chain {
 	struct dma_fence *fence;
 	struct dma_fence_cb cb;
 	struct irq_work work;
+	struct dma_fence_chain *skip;
+	u64 depth;
 };
 
 extern const struct dma_fence_ops dma_fence_chain_ops;
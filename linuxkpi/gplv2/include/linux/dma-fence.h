@@ -93,6 +93,9 @@ struct dma_fence {
 	unsigned long flags;
 	struct kref refcount;
 	int error;
+	/* Only set while compat.linuxkpi.dma_fence.stats is enabled */
+	ktime_t init_time;
+	ktime_t enable_time;
 };
 
 enum dma_fence_flag_bits {
@@ -359,6 +362,7 @@ dma_fence_get_rcu_safe(struct dma_fence __rcu **fencep)
 
 int dma_fence_signal(struct dma_fence *fence);
 int dma_fence_signal_locked(struct dma_fence *fence);
+void dma_fence_stats_signaled(struct dma_fence *fence, unsigned int ncb);
 signed long dma_fence_default_wait(struct dma_fence *fence,
 				   bool intr, signed long timeout);
 int dma_fence_add_callback(struct dma_fence *fence,
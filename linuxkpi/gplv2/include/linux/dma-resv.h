@@ -62,12 +62,17 @@ struct dma_resv_list {
 	struct dma_fence __rcu *shared[];
 };
 
+/* Number of shared fences that fit without allocating a list */
+#define DMA_RESV_INLINE_SHARED	4
+
 /**
  * struct dma_resv - a reservation object manages fences for a buffer
  * @lock: update side lock
  * @seq: sequence count for managing RCU read-side synchronization
  * @fence_excl: the exclusive fence, if there is one currently
  * @fence: list of current shared fences
+ * @fence_inline: storage for the first shared fence list, used until it
+ * needs to grow and never freed, see dma_resv_list_is_inline()
  */
 struct dma_resv {
 	struct ww_mutex lock;
@@ -75,11 +80,29 @@ struct dma_resv {
 
 	struct dma_fence __rcu *fence_excl;
 	struct dma_resv_list __rcu *fence;
+
+	u8 fence_inline[offsetof(struct dma_resv_list, shared) +
+	    DMA_RESV_INLINE_SHARED * sizeof(struct dma_fence *)]
+	    __aligned(sizeof(void *));
 };
 
 #define dma_resv_held(obj) lockdep_is_held(&(obj)->lock.base)
 #define dma_resv_assert_held(obj) lockdep_assert_held(&(obj)->lock.base)
 
+/**
+ * dma_resv_list_is_inline - check for the embedded shared fence list
+ * @obj: the reservation object
+ * @list: shared fence list of @obj
+ *
+ * Returns true if @list is the storage embedded in @obj, which must not be
+ * freed when replacing it.
+ */
+static inline bool dma_resv_list_is_inline(struct dma_resv *obj,
+					   struct dma_resv_list *list)
+{
+	return (void *)list == (void *)obj->fence_inline;
+}
+
 /**
  * dma_resv_get_list - get the reservation object's
  * shared fence list, with update-side lock held
@@ -47,6 +47,23 @@ int request_firmware_nowait(
 
 #define	request_firmware_direct(f,n,d) request_firmware(f,n,d)
 
+/*
+ * Load a set of images concurrently. The names are copied. firmware_batch_get()
+ * waits for a single image and hands its ownership to the caller.
+ * firmware_batch_release() does not wait, loads still in flight finish on
+ * their own. A batch can also be used purely to prefetch images that are
+ * later asked for through request_firmware(): those stay in the firmware
+ * cache, while images nobody claimed or requested by the time the batch is
+ * gone are dropped again, along with their firmware module.
+ */
+struct firmware_batch;
+
+struct firmware_batch *request_firmware_batch(const char * const *names,
+	unsigned int count, struct device *device);
+int firmware_batch_get(struct firmware_batch *batch, unsigned int idx,
+	const struct linux_firmware **fw);
+void firmware_batch_release(struct firmware_batch *batch);
+
 void release_firmware(const struct linux_firmware *fw);
 #define firmware linux_firmware
 #endif
@@ -3,9 +3,22 @@
 
 #include <sys/param.h>
 #include <sys/module.h>
+#include <sys/linker_set.h>
 
 #include_next <linux/module.h>
 
+/*
+ * Record the firmware images a module declares in its linux_module_firmware
+ * linker set, so that a driver can prefetch them (see
+ * request_firmware_batch()) before probing the hardware that needs them.
+ */
+#undef	MODULE_FIRMWARE
+#define	MODULE_FIRMWARE(name)	__MODULE_FIRMWARE(name, __COUNTER__)
+#define	__MODULE_FIRMWARE(name, cnt)	___MODULE_FIRMWARE(name, cnt)
+#define	___MODULE_FIRMWARE(name, cnt)					\
+	static const char __lkpi_fw_##cnt[] = name;			\
+	DATA_SET(linux_module_firmware, __lkpi_fw_##cnt)
+
 
 #define	LKPI_DRIVER_MODULE(mod, init, exit)				\
 	static int mod##_evh(module_t m, int e, void *a)		\
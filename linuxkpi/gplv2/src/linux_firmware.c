@@ -1,39 +1,383 @@
 #include <sys/param.h>
 #include <sys/systm.h>
+#include <sys/counter.h>
 #include <sys/kernel.h>
 #include <sys/linker.h>
+#include <sys/lock.h>
 #include <sys/malloc.h>
+#include <sys/mutex.h>
+#include <sys/eventhandler.h>
+#include <sys/refcount.h>
 #include <sys/firmware.h>
+#include <sys/queue.h>
+#include <sys/sbuf.h>
+#include <sys/sysctl.h>
 
 #include <linux/firmware.h>
+#include <linux/completion.h>
 #include <linux/device.h>
 #include <linux/dmi.h>
+#include <linux/moduleparam.h>
+#include <linux/workqueue.h>
 #undef firmware
 
 MALLOC_DEFINE(M_LKPI_FW, "lkpifw", "LinuxKPI firmware");
 
-int
-request_firmware(const struct linux_firmware **lkfwp, const char *name,
-		     struct device *device)
+/*
+ * Images are registered by the firmware kernel modules while they are being
+ * linked, so a freshly linked image is normally available right away. Should
+ * it not be, wait for further modules to be loaded, but give up after this
+ * long, which matches the worst case of the old fixed sleep and retry loop.
+ */
+#define	LKPI_FW_WAIT_TIMEOUT	(8 * hz)
+
+/*
+ * Cache of loaded images, keyed by the name the driver asked for. Each entry
+ * holds a reference on the image, so later requests (e.g. on resume) take a
+ * new reference on the registered image directly rather than going through
+ * name mapping and module loading again. An entry is created as soon as an
+ * image is first requested, and concurrent requests for an image that is
+ * still loading wait for that load rather than starting their own. Entries
+ * whose load failed are retried by the next request.
+ *
+ * Images that only a batch ever asked for are not marked used. Once the
+ * batch goes away they are dropped again along with the reference on their
+ * firmware module, see lkpi_fw_cache_drop().
+ */
+struct lkpi_fw_entry {
+	TAILQ_ENTRY(lkpi_fw_entry) link;
+	const struct firmware *fw;
+	linker_file_t lf;	/* firmware module linked for the image */
+	char *name;
+	sbintime_t load_time;	/* time taken by the uncached load */
+	u_int hits;
+	bool loading;
+	bool used;
+};
+
+/*
+ * A batch of images loaded concurrently from the unbound workqueue, see
+ * request_firmware_batch(). The caller and every pending load hold a
+ * reference, so firmware_batch_release() does not have to wait for loads
+ * that are still in flight.
+ */
+struct firmware_batch {
+	u_int refs;
+	unsigned int count;
+	struct firmware_batch_entry {
+		struct work_struct work;
+		struct completion done;
+		struct firmware_batch *batch;
+		char *name;
+		const struct linux_firmware *fw;
+		int error;
+		bool claimed;
+	} entries[];
+};
+
+struct firmware_nowait {
+	struct work_struct work;
+	struct device *device;
+	char *name;
+	void *context;
+	void (*cont)(const struct linux_firmware *fw, void *context);
+};
+
+static TAILQ_HEAD(, lkpi_fw_entry) lkpi_fw_cache =
+    TAILQ_HEAD_INITIALIZER(lkpi_fw_cache);
+static struct mtx lkpi_fw_mtx;
+MTX_SYSINIT(lkpi_fw_mtx, &lkpi_fw_mtx, "lkpifw", MTX_DEF);
+
+/* Bumped on every module load, waiters sleep on it */
+static u_int lkpi_fw_kld_gen;
+static eventhandler_tag lkpi_fw_kld_tag;
+
+static SYSCTL_NODE(_compat_linuxkpi, OID_AUTO, firmware, CTLFLAG_RW, 0,
+    "LinuxKPI firmware loader");
+
+static counter_u64_t lkpi_fw_hits;
+static counter_u64_t lkpi_fw_misses;
+SYSCTL_COUNTER_U64(_compat_linuxkpi_firmware, OID_AUTO, hits, CTLFLAG_RD,
+    &lkpi_fw_hits, "Requests served from the firmware cache");
+SYSCTL_COUNTER_U64(_compat_linuxkpi_firmware, OID_AUTO, misses, CTLFLAG_RD,
+    &lkpi_fw_misses, "Requests that had to load the firmware");
+
+static int
+lkpi_fw_sysctl_cache(SYSCTL_HANDLER_ARGS)
+{
+	struct lkpi_fw_entry *entry;
+	struct sbuf sb;
+	int error;
+
+	error = sysctl_wire_old_buffer(req, 0);
+	if (error != 0)
+		return (error);
+
+	sbuf_new_for_sysctl(&sb, NULL, 128, req);
+	sbuf_printf(&sb, "\n%-48s %10s %12s\n", "name", "hits", "load (us)");
+	mtx_lock(&lkpi_fw_mtx);
+	TAILQ_FOREACH(entry, &lkpi_fw_cache, link) {
+		if (entry->fw == NULL)
+			continue;
+		sbuf_printf(&sb, "%-48s %10u %12ju\n", entry->name,
+		    entry->hits, (uintmax_t)sbttous(entry->load_time));
+	}
+	mtx_unlock(&lkpi_fw_mtx);
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+
+	return (error);
+}
+SYSCTL_PROC(_compat_linuxkpi_firmware, OID_AUTO, cache,
+    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+    lkpi_fw_sysctl_cache, "A", "Cached firmware images and load latency");
+
+static void
+lkpi_fw_kld_load(void *arg __unused, linker_file_t lf __unused)
+{
+
+	mtx_lock(&lkpi_fw_mtx);
+	lkpi_fw_kld_gen++;
+	wakeup(&lkpi_fw_kld_gen);
+	mtx_unlock(&lkpi_fw_mtx);
+}
+
+static void
+lkpi_fw_init(void *arg __unused)
+{
+
+	lkpi_fw_hits = counter_u64_alloc(M_WAITOK);
+	lkpi_fw_misses = counter_u64_alloc(M_WAITOK);
+	lkpi_fw_kld_tag = EVENTHANDLER_REGISTER(kld_load, lkpi_fw_kld_load,
+	    NULL, EVENTHANDLER_PRI_ANY);
+}
+SYSINIT(lkpi_fw, SI_SUB_DRIVERS, SI_ORDER_ANY, lkpi_fw_init, NULL);
+
+static void
+lkpi_fw_uninit(void *arg __unused)
+{
+	struct lkpi_fw_entry *entry;
+
+	EVENTHANDLER_DEREGISTER(kld_load, lkpi_fw_kld_tag);
+
+	while ((entry = TAILQ_FIRST(&lkpi_fw_cache)) != NULL) {
+		TAILQ_REMOVE(&lkpi_fw_cache, entry, link);
+		if (entry->fw != NULL)
+			firmware_put(entry->fw, 0);
+		free(entry->name, M_LKPI_FW);
+		free(entry, M_LKPI_FW);
+	}
+
+	counter_u64_free(lkpi_fw_hits);
+	counter_u64_free(lkpi_fw_misses);
+}
+SYSUNINIT(lkpi_fw, SI_SUB_DRIVERS, SI_ORDER_ANY, lkpi_fw_uninit, NULL);
+
+/*
+ * Returns a new reference on the image if it is cached. Otherwise returns
+ * NULL with *entryp set to the entry the caller is now responsible for
+ * loading, and must pass to lkpi_fw_cache_done(). Unless @batch is set the
+ * image is marked used and stays cached.
+ */
+static const struct firmware *
+lkpi_fw_cache_lookup(const char *name, bool batch,
+    struct lkpi_fw_entry **entryp)
+{
+	struct lkpi_fw_entry *entry, *new;
+	const struct firmware *fw;
+
+	new = malloc(sizeof(*new), M_LKPI_FW, M_WAITOK | M_ZERO);
+	new->name = strdup(name, M_LKPI_FW);
+
+	mtx_lock(&lkpi_fw_mtx);
+	TAILQ_FOREACH(entry, &lkpi_fw_cache, link) {
+		if (strcmp(entry->name, name) == 0)
+			break;
+	}
+	if (entry == NULL) {
+		TAILQ_INSERT_TAIL(&lkpi_fw_cache, new, link);
+		entry = new;
+		new = NULL;
+	}
+	while (entry->loading)
+		mtx_sleep(entry, &lkpi_fw_mtx, 0, "fwwait", 0);
+
+	if (!batch)
+		entry->used = true;
+
+	/*
+	 * The cache holds a reference, so the image is still registered and
+	 * firmware_get() only takes another reference for the caller without
+	 * sleeping. Take it before dropping the lock, lkpi_fw_cache_drop()
+	 * may release the cached one as soon as we do.
+	 */
+	fw = NULL;
+	if (entry->fw != NULL) {
+		entry->hits++;
+		fw = firmware_get(entry->fw->name);
+		MPASS(fw != NULL);
+	} else {
+		entry->loading = true;
+	}
+	mtx_unlock(&lkpi_fw_mtx);
+
+	if (new != NULL) {
+		free(new->name, M_LKPI_FW);
+		free(new, M_LKPI_FW);
+	}
+
+	*entryp = entry;
+
+	return (fw);
+}
+
+static void
+lkpi_fw_cache_done(struct lkpi_fw_entry *entry, const struct firmware *fw,
+    linker_file_t lf, sbintime_t load_time)
+{
+	const struct firmware *ref;
+
+	ref = fw != NULL ? firmware_get(fw->name) : NULL;
+
+	mtx_lock(&lkpi_fw_mtx);
+	MPASS(entry->loading);
+	MPASS(entry->lf == NULL);
+	entry->fw = ref;
+	entry->lf = ref != NULL ? lf : NULL;
+	entry->load_time = load_time;
+	entry->loading = false;
+	wakeup(entry);
+	mtx_unlock(&lkpi_fw_mtx);
+
+	/* Nothing cached, do not keep the module around for it either. */
+	if (ref == NULL && lf != NULL)
+		linker_release_module(NULL, NULL, lf);
+}
+
+/* The caller took over an image loaded by a batch, keep it cached. */
+static void
+lkpi_fw_cache_use(const char *name)
+{
+	struct lkpi_fw_entry *entry;
+
+	mtx_lock(&lkpi_fw_mtx);
+	TAILQ_FOREACH(entry, &lkpi_fw_cache, link) {
+		if (strcmp(entry->name, name) == 0) {
+			entry->used = true;
+			break;
+		}
+	}
+	mtx_unlock(&lkpi_fw_mtx);
+}
+
+/*
+ * Drop an image that was only ever loaded on behalf of a batch, along with
+ * the reference on its firmware module, so that unused variants prefetched
+ * by a driver do not stay wired. The entry itself stays, like the one of a
+ * failed load, as waiters may still be looking at it.
+ */
+static void
+lkpi_fw_cache_drop(const char *name)
+{
+	struct lkpi_fw_entry *entry;
+	const struct firmware *fw;
+	linker_file_t lf;
+
+	fw = NULL;
+	lf = NULL;
+	mtx_lock(&lkpi_fw_mtx);
+	TAILQ_FOREACH(entry, &lkpi_fw_cache, link) {
+		if (strcmp(entry->name, name) != 0)
+			continue;
+		if (!entry->used && !entry->loading) {
+			fw = entry->fw;
+			lf = entry->lf;
+			entry->fw = NULL;
+			entry->lf = NULL;
+		}
+		break;
+	}
+	mtx_unlock(&lkpi_fw_mtx);
+
+	if (fw != NULL)
+		firmware_put(fw, 0);
+	if (lf != NULL)
+		linker_release_module(NULL, NULL, lf);
+}
+
+/*
+ * Look the image up under its original name and then under its mapped name,
+ * sleeping until the next module load whenever both fail, for at most
+ * @timeout ticks.
+ */
+static const struct firmware *
+lkpi_fw_wait(const char *name, const char *mapped_name, int timeout)
+{
+	const struct firmware *fw;
+	u_int gen;
+	int deadline;
+
+	deadline = ticks + timeout;
+	for (;;) {
+		mtx_lock(&lkpi_fw_mtx);
+		gen = lkpi_fw_kld_gen;
+		mtx_unlock(&lkpi_fw_mtx);
+
+		fw = firmware_get(name);
+		if (fw == NULL && mapped_name != NULL)
+			fw = firmware_get(mapped_name);
+		if (fw != NULL || deadline - ticks <= 0)
+			return (fw);
+
+		/*
+		 * Images are not only registered from module load, so do not
+		 * rely on the event alone and poll at a low rate as well.
+		 */
+		mtx_lock(&lkpi_fw_mtx);
+		if (gen == lkpi_fw_kld_gen)
+			mtx_sleep(&lkpi_fw_kld_gen, &lkpi_fw_mtx, 0, "fwwait",
+			    max(1, min(hz / 4, deadline - ticks)));
+		mtx_unlock(&lkpi_fw_mtx);
+	}
+}
+
+/*
+ * Batch loads are quiet, do not mark the image used, and must not touch
+ * @device, which may be gone by the time they finish.
+ */
+static int
+lkpi_request_firmware(const struct linux_firmware **lkfwp, const char *name,
+    struct device *device, bool batch)
 {
 	struct linux_firmware *lkfw;
+	struct lkpi_fw_entry *entry;
 	const struct firmware *fw;
 	char *mapped_name, *pindex;
 	linker_file_t result;
-	int rc, retries;
+	sbintime_t start;
+	int rc;
 
 	fw = NULL;
 	*lkfwp = NULL;
 	mapped_name = NULL;
+	result = NULL;
 	lkfw = malloc(sizeof(*lkfw), M_LKPI_FW, M_WAITOK);
-	retries = 0;
-	
+
+	fw = lkpi_fw_cache_lookup(name, batch, &entry);
+	if (fw != NULL) {
+		counter_u64_add(lkpi_fw_hits, 1);
+		goto done;
+	}
+	counter_u64_add(lkpi_fw_misses, 1);
+	start = sbinuptime();
+
 	/*
 	 * First try with mapped name since that's all our firmware modules
 	 */
        	if ((index(name, '/') != NULL) || (index(name, '.') != NULL)) {
 		mapped_name = strdup(name, M_LKPI_FW);
 		if (mapped_name == NULL) {
+			lkpi_fw_cache_done(entry, NULL, NULL, 0);
 			rc = -ENOMEM;
 			goto fail;
 		}
@@ -42,32 +386,18 @@ request_firmware(const struct linux_firmware **lkfwp, const char *name,
 		while ((pindex = index(mapped_name, '.')) != NULL)
 			*pindex = '_';
 		if (linker_reference_module(mapped_name, NULL, &result)) {
-			device_printf(device->bsddev, "failed to link firmware "
-			    "kernel module with mapped name: %s\n", mapped_name);
+			result = NULL;
+			if (!batch)
+				device_printf(device->bsddev, "failed to link "
+				    "firmware kernel module with mapped name: "
+				    "%s\n", mapped_name);
 			goto fail_mapped;
 		}
-	retry:
-		pause("fwwait", hz/2);
-		fw = firmware_get(name);
-		if (fw == NULL) {
-			device_printf(device->bsddev, "fail (%d) to get firmware "
-			    "image with name: %s\n", retries, name);
-			fw = firmware_get(mapped_name);
-			if (fw == NULL) {
-				device_printf(device->bsddev, "fail (%d) to get "
-				    "firmware image with mapped name: %s\n",
-				    retries, name);
-				if (retries++ < 10) {
-					pause("fwwait", hz/4);
-					goto retry;
-				}
-			} else {
-				device_printf(device->bsddev, "successfully loaded firmware "
-				    "image with mapped name: %s\n", mapped_name);
-			}
-		} else {
-			device_printf(device->bsddev, "successfully loaded firmware "
-			    "image with name: %s\n", name);
+		fw = lkpi_fw_wait(name, mapped_name, LKPI_FW_WAIT_TIMEOUT);
+		if (fw == NULL && !batch) {
+			device_printf(device->bsddev, "fail to get firmware "
+			    "image with name: %s, mapped name: %s\n", name,
+			    mapped_name);
 		}
 #ifdef __notyet__
 		/* XXX leave dangling ref */
@@ -77,26 +407,27 @@ request_firmware(const struct linux_firmware **lkfwp, const char *name,
 
 fail_mapped:
 	/*
-	 * Then try the original name
+	 * Then try the original name. A batch only prefetches what is there
+	 * already, a missing image is waited for by whoever really needs it.
 	 */
 	if (fw == NULL) {
-		fw = firmware_get(name);
+		fw = lkpi_fw_wait(name, NULL, batch ? 0 : hz / 2);
 		if (fw == NULL) {
-			pause("fwwait", hz/2);
-			fw = firmware_get(name);
-		}
-		if (fw) {
-			device_printf(device->bsddev, "successfully loaded firmware "
-			    "image with name: %s\n", name);
-		} else {
-			device_printf(device->bsddev, "failed to load firmware "
-			    "with name: %s\n", name);
+			if (!batch)
+				device_printf(device->bsddev, "failed to load "
+				    "firmware with name: %s\n", name);
+			lkpi_fw_cache_done(entry, NULL, result, 0);
 			rc = -ENOENT;
 			goto fail;
 		}
 	}
 
+	if (!batch)
+		device_printf(device->bsddev, "successfully loaded firmware "
+		    "image with name: %s\n", fw->name);
+	lkpi_fw_cache_done(entry, fw, result, sbinuptime() - start);
 	free(mapped_name, M_LKPI_FW);
+done:
 	lkfw->priv = __DECONST(void *, fw);
 	lkfw->size = fw->datasize;
 	lkfw->data = fw->data;
@@ -109,6 +440,141 @@ fail:
 	return (rc);
 }
 
+int
+request_firmware(const struct linux_firmware **lkfwp, const char *name,
+		     struct device *device)
+{
+
+	return (lkpi_request_firmware(lkfwp, name, device, false));
+}
+
+static void
+request_firmware_nowait_work(struct work_struct *work)
+{
+	struct firmware_nowait *req;
+	const struct linux_firmware *fw;
+
+	req = container_of(work, struct firmware_nowait, work);
+	lkpi_request_firmware(&fw, req->name, req->device, false);
+	req->cont(fw, req->context);
+
+	free(req->name, M_LKPI_FW);
+	free(req, M_LKPI_FW);
+}
+
+int
+request_firmware_nowait(struct module *module, bool uevent,
+    const char *name, struct device *device, gfp_t gfp, void *context,
+    void (*cont)(const struct linux_firmware *fw, void *context))
+{
+	struct firmware_nowait *req;
+
+	req = malloc(sizeof(*req), M_LKPI_FW, linux_check_m_flags(gfp));
+	if (req == NULL)
+		return (-ENOMEM);
+
+	req->name = strdup_flags(name, M_LKPI_FW, linux_check_m_flags(gfp));
+	if (req->name == NULL) {
+		free(req, M_LKPI_FW);
+		return (-ENOMEM);
+	}
+	req->device = device;
+	req->context = context;
+	req->cont = cont;
+
+	INIT_WORK(&req->work, request_firmware_nowait_work);
+	queue_work(system_unbound_wq, &req->work);
+
+	return (0);
+}
+
+static void
+firmware_batch_put(struct firmware_batch *batch)
+{
+	struct firmware_batch_entry *entry;
+	unsigned int i;
+
+	if (!refcount_release(&batch->refs))
+		return;
+
+	for (i = 0; i < batch->count; i++) {
+		entry = &batch->entries[i];
+		release_firmware(entry->fw);
+		if (!entry->claimed)
+			lkpi_fw_cache_drop(entry->name);
+		free(entry->name, M_LKPI_FW);
+	}
+
+	free(batch, M_LKPI_FW);
+}
+
+static void
+request_firmware_batch_work(struct work_struct *work)
+{
+	struct firmware_batch_entry *entry;
+
+	entry = container_of(work, struct firmware_batch_entry, work);
+	entry->error = lkpi_request_firmware(&entry->fw, entry->name, NULL,
+	    true);
+	complete(&entry->done);
+	firmware_batch_put(entry->batch);
+}
+
+struct firmware_batch *
+request_firmware_batch(const char * const *names, unsigned int count,
+    struct device *device __unused)
+{
+	struct firmware_batch *batch;
+	unsigned int i;
+
+	batch = malloc(sizeof(*batch) + count * sizeof(batch->entries[0]),
+	    M_LKPI_FW, M_WAITOK | M_ZERO);
+	batch->count = count;
+	refcount_init(&batch->refs, count + 1);
+
+	for (i = 0; i < count; i++) {
+		struct firmware_batch_entry *entry = &batch->entries[i];
+
+		entry->batch = batch;
+		entry->name = strdup(names[i], M_LKPI_FW);
+		init_completion(&entry->done);
+		INIT_WORK(&entry->work, request_firmware_batch_work);
+		queue_work(system_unbound_wq, &entry->work);
+	}
+
+	return (batch);
+}
+
+int
+firmware_batch_get(struct firmware_batch *batch, unsigned int idx,
+    const struct linux_firmware **fw)
+{
+	struct firmware_batch_entry *entry;
+
+	MPASS(idx < batch->count);
+	entry = &batch->entries[idx];
+
+	wait_for_completion(&entry->done);
+	*fw = entry->fw;
+	entry->fw = NULL;
+	if (!entry->claimed) {
+		entry->claimed = true;
+		lkpi_fw_cache_use(entry->name);
+	}
+
+	return (entry->error);
+}
+
+void
+firmware_batch_release(struct firmware_batch *batch)
+{
+
+	if (batch == NULL)
+		return;
+
+	firmware_batch_put(batch);
+}
+
 void
 release_firmware(const struct linux_firmware *lkfw)
 {
@@ -28,9 +28,12 @@
 
 #include <sys/param.h>
 
+#include <sys/counter.h>
+#include <sys/kernel.h>
 #include <sys/lock.h>
 #include <sys/rwlock.h>
 #include <sys/sf_buf.h>
+#include <sys/sysctl.h>
 
 #include <machine/atomic.h>
 
@@ -43,6 +46,7 @@
 
 #include <linux/io.h>
 #include <linux/mm.h>
+#include <linux/moduleparam.h>
 #include <linux/page.h>
 #include <linux/pfn_t.h>
 #include <linux/vmalloc.h>
@@ -55,6 +59,61 @@
 #undef	LINUXKPI_HAVE_DMAP
 #endif
 
+static SYSCTL_NODE(_compat_linuxkpi, OID_AUTO, page, CTLFLAG_RW, 0,
+    "LinuxKPI page mapping");
+
+static counter_u64_t lkpi_unmap_calls;
+static counter_u64_t lkpi_unmap_pages;
+static counter_u64_t lkpi_unmap_retries;
+SYSCTL_COUNTER_U64(_compat_linuxkpi_page, OID_AUTO, unmap_calls, CTLFLAG_RD,
+    &lkpi_unmap_calls, "unmap_mapping_range() calls with a pager object");
+SYSCTL_COUNTER_U64(_compat_linuxkpi_page, OID_AUTO, unmap_pages, CTLFLAG_RD,
+    &lkpi_unmap_pages, "Resident pages removed by unmap_mapping_range()");
+SYSCTL_COUNTER_U64(_compat_linuxkpi_page, OID_AUTO, unmap_retries, CTLFLAG_RD,
+    &lkpi_unmap_retries, "unmap_mapping_range() waits on busy pages");
+
+static counter_u64_t lkpi_memattr_calls;
+static counter_u64_t lkpi_memattr_pages;
+static counter_u64_t lkpi_memattr_skipped;
+static counter_u64_t lkpi_memattr_flushes;
+SYSCTL_COUNTER_U64(_compat_linuxkpi_page, OID_AUTO, memattr_calls, CTLFLAG_RD,
+    &lkpi_memattr_calls, "set_pages_array_*() calls");
+SYSCTL_COUNTER_U64(_compat_linuxkpi_page, OID_AUTO, memattr_pages, CTLFLAG_RD,
+    &lkpi_memattr_pages, "Pages whose memory attribute was changed");
+SYSCTL_COUNTER_U64(_compat_linuxkpi_page, OID_AUTO, memattr_skipped, CTLFLAG_RD,
+    &lkpi_memattr_skipped, "Pages that already had the requested attribute");
+SYSCTL_COUNTER_U64(_compat_linuxkpi_page, OID_AUTO, memattr_flushes, CTLFLAG_RD,
+    &lkpi_memattr_flushes,
+    "TLB shootdowns and cache flushes issued by set_pages_array_*()");
+
+static void
+lkpi_page_init(void *arg __unused)
+{
+
+	lkpi_unmap_calls = counter_u64_alloc(M_WAITOK);
+	lkpi_unmap_pages = counter_u64_alloc(M_WAITOK);
+	lkpi_unmap_retries = counter_u64_alloc(M_WAITOK);
+	lkpi_memattr_calls = counter_u64_alloc(M_WAITOK);
+	lkpi_memattr_pages = counter_u64_alloc(M_WAITOK);
+	lkpi_memattr_skipped = counter_u64_alloc(M_WAITOK);
+	lkpi_memattr_flushes = counter_u64_alloc(M_WAITOK);
+}
+SYSINIT(lkpi_page, SI_SUB_DRIVERS, SI_ORDER_ANY, lkpi_page_init, NULL);
+
+static void
+lkpi_page_uninit(void *arg __unused)
+{
+
+	counter_u64_free(lkpi_unmap_calls);
+	counter_u64_free(lkpi_unmap_pages);
+	counter_u64_free(lkpi_unmap_retries);
+	counter_u64_free(lkpi_memattr_calls);
+	counter_u64_free(lkpi_memattr_pages);
+	counter_u64_free(lkpi_memattr_skipped);
+	counter_u64_free(lkpi_memattr_flushes);
+}
+SYSUNINIT(lkpi_page, SI_SUB_DRIVERS, SI_ORDER_ANY, lkpi_page_uninit, NULL);
+
 #if defined(__i386__) || defined(__amd64__)
 extern u_int	cpu_feature;
 extern u_int	cpu_stdext_feature;
@@ -217,12 +276,21 @@ page_to_phys(vm_page_t page)
 	return (VM_PAGE_TO_PHYS(page));
 }
 
+/*
+ * The pager object is per mapped buffer object and its pages are indexed
+ * from the start of that buffer, so holebegin is an offset into the buffer
+ * rather than into the device's mmap offset space as on Linux. Only the
+ * pages resident in the hole are visited, in pindex order through the
+ * object's page list, so the cost does not depend on the size of the
+ * buffer or of the hole.
+ */
 void
 unmap_mapping_range(void *obj, loff_t const holebegin, loff_t const holelen, int even_cows)
 {
 	vm_object_t devobj;
-	vm_page_t page;
-	int i, page_count;
+	vm_page_t page, next;
+	vm_pindex_t start, end, pindex;
+	u_int count;
 
 #ifdef LINUX_VERBOSE_DEBUG
 	BACKTRACE();
@@ -231,51 +299,118 @@ unmap_mapping_range(void *obj, loff_t const holebegin, loff_t const holelen, int
 #endif
 	devobj = cdev_pager_lookup(obj);
 	if (devobj != NULL) {
-		page_count = OFF_TO_IDX(holelen);
+		start = OFF_TO_IDX(holebegin);
+		end = holelen != 0 ? OFF_TO_IDX(holebegin + holelen + PAGE_MASK) :
+		    devobj->size;
+		count = 0;
 
 		VM_OBJECT_WLOCK(devobj);
-retry:
-		for (i = 0; i < page_count; i++) {
-			page = vm_page_lookup(devobj, i);
-			if (page == NULL)
+		page = vm_page_find_least(devobj, start);
+		while (page != NULL && page->pindex < end) {
+			pindex = page->pindex;
+			if (!vm_page_busy_acquire(page, VM_ALLOC_WAITFAIL)) {
+				/*
+				 * The object lock was dropped while waiting,
+				 * so look up the same index again rather than
+				 * starting over from the beginning of the hole.
+				 */
+				counter_u64_add(lkpi_unmap_retries, 1);
+				page = vm_page_find_least(devobj, pindex);
 				continue;
-			if (!vm_page_busy_acquire(page, VM_ALLOC_WAITFAIL))
-				goto retry;
+			}
+			next = TAILQ_NEXT(page, listq);
 			cdev_pager_free_page(devobj, page);
+			count++;
+			page = next;
 		}
 		VM_OBJECT_WUNLOCK(devobj);
 		vm_object_deallocate(devobj);
+
+		counter_u64_add(lkpi_unmap_calls, 1);
+		counter_u64_add(lkpi_unmap_pages, count);
 	}
 }
 
 #if defined(__i386__) || defined(__amd64__) || defined(__powerpc__)
-int
-set_pages_array_wb(struct page **pages, int addrinarray)
+/*
+ * Change the memory attribute of an array of pages. Changing the attribute
+ * of a page also changes its direct map entry, which costs a TLB shootdown
+ * and a cache flush. On amd64 the direct map of each run of physically
+ * contiguous pages is changed with a single pmap_change_attr() call, after
+ * which pmap_page_set_memattr() finds the direct map already up to date and
+ * only records the attribute in the page. Pages that already have the
+ * attribute, which is common when pages cycle through the TTM pools, are
+ * left alone.
+ *
+ * The pmap has no interface to change a page's attribute without
+ * invalidating, so isolated pages, which the order-0 TTM pools mostly
+ * hand out, still cost one flush each. memattr_flushes against
+ * memattr_pages shows how much batching a workload actually gets.
+ */
+static int
+lkpi_set_pages_array_memattr(struct page **pages, int addrinarray,
+    vm_memattr_t attr)
 {
-	int i;
+	vm_page_t page;
+	int i, j, run, count, skipped, flushes;
+
+	count = skipped = flushes = 0;
+	for (i = 0; i < addrinarray; i += run) {
+		page = pages[i];
+		run = 1;
+		if (pmap_page_get_memattr(page) == attr) {
+			skipped++;
+			continue;
+		}
+#ifdef __amd64__
+		if ((page->flags & PG_FICTITIOUS) == 0) {
+			while (i + run < addrinarray &&
+			    (pages[i + run]->flags & PG_FICTITIOUS) == 0 &&
+			    pmap_page_get_memattr(pages[i + run]) != attr &&
+			    VM_PAGE_TO_PHYS(pages[i + run]) ==
+			    VM_PAGE_TO_PHYS(page) + ptoa(run))
+				run++;
+			if (run > 1 && pmap_change_attr(
+			    PHYS_TO_DMAP(VM_PAGE_TO_PHYS(page)), ptoa(run),
+			    attr) == 0)
+				flushes++;
+			else
+				flushes += run;
+		}
+#else
+		if ((page->flags & PG_FICTITIOUS) == 0)
+			flushes++;
+#endif
+		for (j = 0; j < run; j++)
+			pmap_page_set_memattr(pages[i + j], attr);
+		count += run;
+	}
 
-	for (i = 0; i < addrinarray; i++)
-		set_pages_wb(pages[i], 1);
+	counter_u64_add(lkpi_memattr_calls, 1);
+	counter_u64_add(lkpi_memattr_pages, count);
+	counter_u64_add(lkpi_memattr_skipped, skipped);
+	counter_u64_add(lkpi_memattr_flushes, flushes);
 	return (0);
 }
 
 int
-set_pages_array_wc(struct page **pages, int addrinarray)
+set_pages_array_wb(struct page **pages, int addrinarray)
 {
-	int i;
+	return (lkpi_set_pages_array_memattr(pages, addrinarray,
+	    VM_MEMATTR_WRITE_BACK));
+}
 
-	for (i = 0; i < addrinarray; i++)
-		set_pages_wc(pages[i], 1);
-	return (0);
+int
+set_pages_array_wc(struct page **pages, int addrinarray)
+{
+	return (lkpi_set_pages_array_memattr(pages, addrinarray,
+	    VM_MEMATTR_WRITE_COMBINING));
 }
 
 int
 set_pages_array_uc(struct page **pages, int addrinarray)
 {
-	int i;
-
-	for (i = 0; i < addrinarray; i++)
-		set_pages_uc(pages[i], 1);
-	return (0);
+	return (lkpi_set_pages_array_memattr(pages, addrinarray,
+	    VM_MEMATTR_UNCACHEABLE));
 }
 #endif
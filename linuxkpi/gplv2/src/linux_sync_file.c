@@ -52,13 +52,29 @@ err:
 	return NULL;
 }
 
+static void sync_file_wakeup(struct sync_file *sync_file)
+{
+#ifdef __linux__
+	wake_up_all(&sync_file->wq);
+#elif defined(__FreeBSD__)
+	/*
+	 * Post the signal straight to the file's selinfo and knote list
+	 * rather than bouncing it through the poll wait queue, so kqueue
+	 * waiters are activated directly by the fence callback. Readiness
+	 * never goes away once signaled, so both level and EV_CLEAR knotes
+	 * see exactly one activation.
+	 */
+	linux_poll_wakeup(sync_file->file);
+#endif
+}
+
 static void fence_check_cb_func(struct dma_fence *f, struct dma_fence_cb *cb)
 {
 	struct sync_file *sync_file;
 
 	sync_file = container_of(cb, struct sync_file, cb);
 
-	wake_up_all(&sync_file->wq);
+	sync_file_wakeup(sync_file);
 }
 
 /**
@@ -317,13 +333,23 @@ static unsigned int sync_file_poll(struct file *file, poll_table *wait)
 {
 	struct sync_file *sync_file = file->private_data;
 
+#ifdef __linux__
 	poll_wait(file, &sync_file->wq, wait);
+#elif defined(__FreeBSD__)
+	/*
+	 * Wakeups do not go through the wait queue, see sync_file_wakeup(),
+	 * so only select() needs recording. kqueue polls with a NULL table
+	 * when the knote is attached, which arms the fence callback below.
+	 */
+	if (wait != NULL)
+		selrecord(curthread, &file->f_selinfo);
+#endif
 
 	if (list_empty(&sync_file->cb.node) &&
 	    !test_and_set_bit(POLL_ENABLED, &sync_file->flags)) {
 		if (dma_fence_add_callback(sync_file->fence, &sync_file->cb,
 					   fence_check_cb_func) < 0)
-			wake_up_all(&sync_file->wq);
+			sync_file_wakeup(sync_file);
 	}
 
 	return dma_fence_is_signaled(sync_file->fence) ? POLLIN : 0;
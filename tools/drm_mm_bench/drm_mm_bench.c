@@ -0,0 +1,609 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Userspace benchmark for the drm_mm range allocator.
+ *
+ * drivers/gpu/drm/drm_mm.c and the LinuxKPI rbtree are compiled unmodified
+ * against the shims in shim/ and driven by either a synthetic workload or a
+ * recorded trace. Every insert and remove is timed individually and the
+ * latency distribution is printed together with drm_mm_print_stats(), so
+ * changes to the search paths can be compared on the same trace. With -z the
+ * allocator additionally uses the segregated-fit index enabled by
+ * drm_mm_enable_size_classes().
+ *
+ * Trace format, one operation per line:
+ *
+ *	i <id> <size> <alignment> <color> <range_start> <range_end> <mode>
+ *	r <id>
+ *
+ * where <mode> is one of b(est), l(ow), h(igh) or e(vict). An 'e' insert is
+ * a DRM_MM_INSERT_BEST insert that, on -ENOSPC, runs an eviction scan over the
+ * live nodes in LRU order and retries with DRM_MM_INSERT_EVICT, the way the
+ * drivers use drm_mm_scan. Evicted nodes are not written to the trace since
+ * replaying the same trace evicts the same nodes again.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+
+#include <drm/drm_mm.h>
+
+struct bench_node {
+	struct drm_mm_node node;
+	struct list_head lru;
+	struct list_head evict_link;
+	unsigned int live_idx;
+	unsigned int free_idx;
+};
+
+struct bench_lat {
+	const char *name;
+	u64 *ns;
+	size_t count, alloc;
+};
+
+struct bench {
+	struct drm_mm mm;
+	u64 mm_size;
+
+	struct bench_node *nodes;
+	unsigned int max_nodes;
+	unsigned int *live;
+	unsigned int nr_live;
+	unsigned int *free_ids;
+	unsigned int nr_free;
+	struct list_head lru;
+
+	u64 guard;
+	u64 used;
+
+	u64 insert_fail;
+	bool last_failed;
+	u64 evict_runs;
+	u64 evicted;
+
+	struct bench_lat lat_insert;
+	struct bench_lat lat_evict;
+	struct bench_lat lat_remove;
+
+	FILE *record;
+};
+
+struct bench_op {
+	char type;
+	unsigned int id;
+	u64 size;
+	u64 alignment;
+	unsigned long color;
+	u64 range_start;
+	u64 range_end;
+	char mode;
+};
+
+static u64
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64*, so that a seed gives the same workload on every libc. */
+static u64 rng_state = 0x2545f4914f6cdd1dULL;
+
+static u64
+rng(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static void
+lat_add(struct bench_lat *lat, u64 ns)
+{
+	if (lat->count == lat->alloc) {
+		lat->alloc = lat->alloc ? lat->alloc * 2 : 4096;
+		lat->ns = realloc(lat->ns, lat->alloc * sizeof(*lat->ns));
+		if (lat->ns == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	lat->ns[lat->count++] = ns;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+lat_print(struct bench_lat *lat)
+{
+	u64 sum = 0;
+	size_t i;
+
+	if (lat->count == 0) {
+		printf("%-7s %10u\n", lat->name, 0);
+		return;
+	}
+
+	qsort(lat->ns, lat->count, sizeof(*lat->ns), cmp_u64);
+	for (i = 0; i < lat->count; i++)
+		sum += lat->ns[i];
+
+	printf("%-7s %10zu %8llu %8llu %8llu %8llu %10llu\n", lat->name,
+	    lat->count, sum / lat->count,
+	    lat->ns[lat->count / 2],
+	    lat->ns[lat->count * 90 / 100],
+	    lat->ns[lat->count * 99 / 100],
+	    lat->ns[lat->count - 1]);
+}
+
+/*
+ * Same policy as i915_gem_color_adjust(): keep a guard between neighbours of
+ * different colour.
+ */
+static void
+bench_color_adjust(const struct drm_mm_node *hole, unsigned long color,
+    u64 *start, u64 *end)
+{
+	const struct bench *b = container_of(hole->mm, struct bench, mm);
+	const struct drm_mm_node *next;
+
+	if (drm_mm_node_allocated(hole) && hole->color != color)
+		*start += b->guard;
+
+	next = list_next_entry(hole, node_list);
+	if (drm_mm_node_allocated(next) && next->color != color)
+		*end -= b->guard;
+}
+
+static void
+free_push(struct bench *b, unsigned int id)
+{
+	b->nodes[id].free_idx = b->nr_free;
+	b->free_ids[b->nr_free++] = id;
+}
+
+static unsigned int
+free_pop(struct bench *b)
+{
+	return b->free_ids[--b->nr_free];
+}
+
+/* Replayed ids are fixed by the trace, claim that particular slot. */
+static void
+free_take(struct bench *b, unsigned int id)
+{
+	unsigned int idx = b->nodes[id].free_idx;
+	unsigned int last;
+
+	if (idx >= b->nr_free || b->free_ids[idx] != id) {
+		fprintf(stderr, "trace reuses live id %u\n", id);
+		exit(1);
+	}
+	last = free_pop(b);
+	b->free_ids[idx] = last;
+	b->nodes[last].free_idx = idx;
+}
+
+static void
+live_add(struct bench *b, unsigned int id)
+{
+	b->nodes[id].live_idx = b->nr_live;
+	b->live[b->nr_live++] = id;
+	list_add_tail(&b->nodes[id].lru, &b->lru);
+	b->used += b->nodes[id].node.size;
+}
+
+static void
+live_del(struct bench *b, unsigned int id)
+{
+	unsigned int idx = b->nodes[id].live_idx;
+	unsigned int last = b->live[--b->nr_live];
+
+	b->live[idx] = last;
+	b->nodes[last].live_idx = idx;
+	list_del(&b->nodes[id].lru);
+	b->used -= b->nodes[id].node.size;
+	free_push(b, id);
+}
+
+static void
+bench_remove(struct bench *b, unsigned int id)
+{
+	u64 t0;
+
+	t0 = now_ns();
+	drm_mm_remove_node(&b->nodes[id].node);
+	lat_add(&b->lat_remove, now_ns() - t0);
+	live_del(b, id);
+}
+
+/*
+ * Find and evict enough of the least recently inserted nodes to fit @op,
+ * following the scan protocol the drivers use. Returns true if a hole was
+ * opened up.
+ */
+static bool
+bench_evict(struct bench *b, const struct bench_op *op)
+{
+	struct bench_node *bn, *next;
+	struct drm_mm_node *node;
+	struct drm_mm_scan scan;
+	LIST_HEAD(eviction_list);
+	bool found = false;
+
+	b->evict_runs++;
+	drm_mm_scan_init_with_range(&scan, &b->mm, op->size, op->alignment,
+	    op->color, op->range_start, op->range_end, DRM_MM_INSERT_BEST);
+
+	list_for_each_entry(bn, &b->lru, lru) {
+		list_add(&bn->evict_link, &eviction_list);
+		if (drm_mm_scan_add_block(&scan, &bn->node)) {
+			found = true;
+			break;
+		}
+	}
+
+	/* Blocks must be removed from the scan in reverse order of adding. */
+	list_for_each_entry_safe(bn, next, &eviction_list, evict_link) {
+		if (!drm_mm_scan_remove_block(&scan, &bn->node) || !found)
+			list_del(&bn->evict_link);
+	}
+
+	if (!found)
+		return false;
+
+	list_for_each_entry_safe(bn, next, &eviction_list, evict_link) {
+		list_del(&bn->evict_link);
+		drm_mm_remove_node(&bn->node);
+		live_del(b, bn - b->nodes);
+		b->evicted++;
+	}
+
+	while ((node = drm_mm_scan_color_evict(&scan)) != NULL) {
+		bn = container_of(node, struct bench_node, node);
+		drm_mm_remove_node(node);
+		live_del(b, bn - b->nodes);
+		b->evicted++;
+	}
+
+	return true;
+}
+
+static void
+bench_insert(struct bench *b, const struct bench_op *op)
+{
+	struct bench_node *bn = &b->nodes[op->id];
+	enum drm_mm_insert_mode mode;
+	u64 t0, t1;
+	int err;
+
+	switch (op->mode) {
+	case 'l':
+		mode = DRM_MM_INSERT_LOW;
+		break;
+	case 'h':
+		mode = DRM_MM_INSERT_HIGH;
+		break;
+	default:
+		mode = DRM_MM_INSERT_BEST;
+		break;
+	}
+
+	memset(&bn->node, 0, sizeof(bn->node));
+	t0 = now_ns();
+	err = drm_mm_insert_node_in_range(&b->mm, &bn->node, op->size,
+	    op->alignment, op->color, op->range_start, op->range_end, mode);
+	t1 = now_ns();
+	lat_add(&b->lat_insert, t1 - t0);
+
+	if (err == -ENOSPC && op->mode == 'e') {
+		if (bench_evict(b, op))
+			err = drm_mm_insert_node_in_range(&b->mm, &bn->node,
+			    op->size, op->alignment, op->color,
+			    op->range_start, op->range_end,
+			    DRM_MM_INSERT_EVICT);
+		lat_add(&b->lat_evict, now_ns() - t1);
+	}
+
+	b->last_failed = err != 0;
+	if (err) {
+		b->insert_fail++;
+		free_push(b, op->id);
+		return;
+	}
+
+	live_add(b, op->id);
+}
+
+static void
+bench_run_op(struct bench *b, const struct bench_op *op)
+{
+	if (b->record) {
+		if (op->type == 'i')
+			fprintf(b->record, "i %u %llu %llu %lu %llu %llu %c\n",
+			    op->id, op->size, op->alignment, op->color,
+			    op->range_start, op->range_end, op->mode);
+		else
+			fprintf(b->record, "r %u\n", op->id);
+	}
+
+	if (op->type == 'i')
+		bench_insert(b, op);
+	else if (drm_mm_node_allocated(&b->nodes[op->id].node))
+		bench_remove(b, op->id);
+}
+
+static int
+bench_replay(struct bench *b, FILE *f)
+{
+	struct bench_op op;
+	char line[256];
+	unsigned long lineno = 0;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		memset(&op, 0, sizeof(op));
+		op.type = line[0];
+		if (op.type == 'i' &&
+		    sscanf(line + 1, "%u %llu %llu %lu %llu %llu %c", &op.id,
+		    &op.size, &op.alignment, &op.color, &op.range_start,
+		    &op.range_end, &op.mode) == 7 && op.id < b->max_nodes) {
+			free_take(b, op.id);
+		} else if (op.type == 'r' &&
+		    sscanf(line + 1, "%u", &op.id) == 1 &&
+		    op.id < b->max_nodes) {
+		} else {
+			fprintf(stderr, "bad trace line %lu: %s", lineno, line);
+			return -1;
+		}
+		bench_run_op(b, &op);
+	}
+
+	return 0;
+}
+
+struct bench_params {
+	unsigned long ops;
+	char mode;
+	unsigned int max_order;
+	u64 alignment;
+	unsigned int colors;
+	unsigned int range_pct;
+	unsigned int fill_pct;
+};
+
+/*
+ * Synthetic workload: mostly small allocations with a long tail of large ones,
+ * freeing a random node whenever usage is above the fill target or the last
+ * insert failed because the space is too fragmented. In evict mode
+ * nothing is freed explicitly and eviction keeps usage at the limit instead.
+ * A quarter of the inserts are restricted to the bottom @range_pct of the
+ * address space, like objects that need to be CPU mappable through the
+ * aperture.
+ */
+static void
+bench_generate(struct bench *b, const struct bench_params *p)
+{
+	static const char modes[] = "blh";
+	struct bench_op op;
+	unsigned long n;
+
+	for (n = 0; n < p->ops; n++) {
+		memset(&op, 0, sizeof(op));
+
+		if (p->mode != 'e' && b->nr_live &&
+		    (b->nr_free == 0 || b->last_failed ||
+		     b->used * 100 >= b->mm_size * p->fill_pct)) {
+			op.type = 'r';
+			op.id = b->live[rng() % b->nr_live];
+			bench_run_op(b, &op);
+			b->last_failed = false;
+			continue;
+		}
+
+		if (b->nr_free == 0) {
+			/* Out of slots in evict mode, drop the oldest node. */
+			op.type = 'r';
+			op.id = list_first_entry(&b->lru, struct bench_node,
+			    lru) - b->nodes;
+			bench_run_op(b, &op);
+			continue;
+		}
+
+		op.type = 'i';
+		op.id = free_pop(b);
+		/* Geometric distribution of orders, then a random size in it. */
+		op.size = 1ULL << (__builtin_ctzll(rng() | (1ULL << p->max_order)));
+		op.size += rng() % op.size;
+		op.alignment = p->alignment;
+		op.color = p->colors > 1 ? rng() % p->colors : 0;
+		op.range_start = 0;
+		op.range_end = b->mm_size;
+		if (p->range_pct < 100 && rng() % 4 == 0)
+			op.range_end = b->mm_size * p->range_pct / 100;
+		op.mode = p->mode == 'm' ? modes[rng() % 3] : p->mode;
+		bench_run_op(b, &op);
+	}
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	    "usage: drm_mm_bench [-m best|low|high|mixed|evict] [-n ops]\n"
+	    "                    [-s mm_size] [-N max_nodes] [-o max_order]\n"
+	    "                    [-a alignment] [-c colors] [-g guard]\n"
+	    "                    [-r range_pct] [-f fill_pct] [-S seed]\n"
+	    "                    [-w record_trace] [-t replay_trace] [-v] [-z]\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bench_params p = {
+		.ops = 1000000,
+		.mode = 'b',
+		.max_order = 8,
+		.alignment = 0,
+		.colors = 1,
+		.range_pct = 100,
+		.fill_pct = 90,
+	};
+	struct drm_printer printer = { .f = stdout };
+	struct bench b;
+	const char *replay = NULL, *record = NULL;
+	bool size_classes = false;
+	bool verbose = false;
+	unsigned int i;
+	u64 t0, total;
+	int ch, ret = 0;
+
+	memset(&b, 0, sizeof(b));
+	b.mm_size = 1ULL << 18;
+	b.max_nodes = 1U << 16;
+	b.guard = 1;
+
+	while ((ch = getopt(argc, argv, "a:c:f:g:m:n:N:o:r:s:S:t:vw:z")) != -1) {
+		switch (ch) {
+		case 'a':
+			p.alignment = strtoull(optarg, NULL, 0);
+			break;
+		case 'c':
+			p.colors = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			p.fill_pct = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			b.guard = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			p.mode = optarg[0];
+			if (strchr("blhme", p.mode) == NULL)
+				usage();
+			break;
+		case 'n':
+			p.ops = strtoul(optarg, NULL, 0);
+			break;
+		case 'N':
+			b.max_nodes = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			p.max_order = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			p.range_pct = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			b.mm_size = strtoull(optarg, NULL, 0);
+			break;
+		case 'S':
+			rng_state = strtoull(optarg, NULL, 0);
+			if (rng_state == 0)
+				rng_state = 1;
+			break;
+		case 't':
+			replay = optarg;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'w':
+			record = optarg;
+			break;
+		case 'z':
+			size_classes = true;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc || b.max_nodes == 0 || p.max_order > 40 ||
+	    p.range_pct == 0 || p.range_pct > 100)
+		usage();
+
+	b.nodes = calloc(b.max_nodes, sizeof(*b.nodes));
+	b.live = calloc(b.max_nodes, sizeof(*b.live));
+	b.free_ids = calloc(b.max_nodes, sizeof(*b.free_ids));
+	if (b.nodes == NULL || b.live == NULL || b.free_ids == NULL) {
+		perror("calloc");
+		return 1;
+	}
+	/* Hand out low ids first. */
+	for (i = b.max_nodes; i-- > 0;)
+		free_push(&b, i);
+	INIT_LIST_HEAD(&b.lru);
+	b.lat_insert.name = "insert";
+	b.lat_evict.name = "evict";
+	b.lat_remove.name = "remove";
+
+	if (record != NULL && (b.record = fopen(record, "w")) == NULL) {
+		perror(record);
+		return 1;
+	}
+
+	drm_mm_init(&b.mm, 0, b.mm_size);
+	if (size_classes && drm_mm_enable_size_classes(&b.mm)) {
+		fprintf(stderr, "drm_mm_enable_size_classes failed\n");
+		return 1;
+	}
+	if (b.guard)
+		b.mm.color_adjust = bench_color_adjust;
+
+	t0 = now_ns();
+	if (replay != NULL) {
+		FILE *f = strcmp(replay, "-") ? fopen(replay, "r") : stdin;
+
+		if (f == NULL) {
+			perror(replay);
+			return 1;
+		}
+		ret = bench_replay(&b, f);
+		if (f != stdin)
+			fclose(f);
+	} else {
+		bench_generate(&b, &p);
+	}
+	total = now_ns() - t0;
+
+	printf("%-7s %10s %8s %8s %8s %8s %10s\n",
+	    "ns", "count", "mean", "p50", "p90", "p99", "max");
+	lat_print(&b.lat_insert);
+	lat_print(&b.lat_evict);
+	lat_print(&b.lat_remove);
+	printf("total %llu ms, %llu failed inserts, %llu evictions of %llu nodes, "
+	    "%u live nodes using %llu/%llu\n",
+	    total / 1000000, b.insert_fail, b.evict_runs, b.evicted,
+	    b.nr_live, b.used, b.mm_size);
+	drm_mm_print_stats(&b.mm, &printer);
+	if (verbose)
+		drm_mm_print(&b.mm, &printer);
+
+	while (b.nr_live)
+		bench_remove(&b, b.live[b.nr_live - 1]);
+	drm_mm_takedown(&b.mm);
+
+	if (b.record != NULL)
+		fclose(b.record);
+	free(b.lat_insert.ns);
+	free(b.lat_evict.ns);
+	free(b.lat_remove.ns);
+	free(b.nodes);
+	free(b.live);
+	free(b.free_ids);
+
+	return ret ? 1 : 0;
+}
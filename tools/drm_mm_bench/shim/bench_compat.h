@@ -0,0 +1,232 @@
+/*
+ * Minimal userspace stand-ins for the kernel interfaces used by drm_mm.c and
+ * the LinuxKPI rbtree, so that both can be built and timed as a normal
+ * program. Only what those two files actually use is provided; everything
+ * else is left out on purpose so that a new dependency shows up as a build
+ * error rather than as a silently wrong stub.
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef _BENCH_COMPAT_H_
+#define _BENCH_COMPAT_H_
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int32_t s32;
+typedef long long s64;
+typedef unsigned int gfp_t;
+
+#define GFP_KERNEL	0
+#define GFP_NOWAIT	0
+
+#ifndef __always_inline
+#define __always_inline	inline __attribute__((__always_inline__))
+#endif
+#define noinline	__attribute__((__noinline__))
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+
+#define READ_ONCE(x)		(*(volatile __typeof(x) *)&(x))
+#define WRITE_ONCE(x, v)	do { *(volatile __typeof(x) *)&(x) = (v); } while (0)
+#define rcu_assign_pointer(p, v)	WRITE_ONCE(p, v)
+
+#ifndef __DECONST
+#define __DECONST(type, var)	((type)(uintptr_t)(const void *)(var))
+#endif
+
+#define EXPORT_SYMBOL(sym)
+#define EXPORT_SYMBOL_GPL(sym)
+
+#ifndef container_of
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#endif
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+#endif
+
+#define BIT(n)		(1UL << (n))
+#define BIT_ULL(n)	(1ULL << (n))
+#define U64_MAX		((u64)~0ULL)
+
+#undef min
+#undef max
+#define min(a, b) ({ __typeof(a) _a = (a); __typeof(b) _b = (b); _a < _b ? _a : _b; })
+#define max(a, b) ({ __typeof(a) _a = (a); __typeof(b) _b = (b); _a > _b ? _a : _b; })
+#define min_t(t, a, b)	min((t)(a), (t)(b))
+#define max_t(t, a, b)	max((t)(a), (t)(b))
+
+#define BUG_ON(expr) do {						\
+	if (unlikely(expr)) {						\
+		fprintf(stderr, "BUG_ON(%s) at %s:%d\n",		\
+			#expr, __FILE__, __LINE__);			\
+		abort();						\
+	}								\
+} while (0)
+#define BUILD_BUG_ON_INVALID(expr)	((void)(sizeof((long)(expr))))
+#define WARN_ON(expr) ({						\
+	int _w = !!(expr);						\
+	if (unlikely(_w))						\
+		fprintf(stderr, "WARN_ON(%s) at %s:%d\n",		\
+			#expr, __FILE__, __LINE__);			\
+	unlikely(_w);							\
+})
+#define WARN(cond, ...) ({						\
+	int _w = !!(cond);						\
+	if (unlikely(_w))						\
+		fprintf(stderr, __VA_ARGS__);				\
+	unlikely(_w);							\
+})
+
+static inline bool
+is_power_of_2(unsigned long n)
+{
+	return n != 0 && (n & (n - 1)) == 0;
+}
+
+static inline int
+fls64(u64 x)
+{
+	return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+static inline unsigned long
+__ffs(unsigned long x)
+{
+	return __builtin_ctzl(x);
+}
+
+static inline unsigned long
+__ffs64(u64 x)
+{
+	return __builtin_ctzll(x);
+}
+
+static inline u64
+div64_u64(u64 dividend, u64 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline u64
+div64_u64_rem(u64 dividend, u64 divisor, u64 *remainder)
+{
+	*remainder = dividend % divisor;
+	return dividend / divisor;
+}
+
+static inline u64
+ktime_get_raw_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void *
+kmalloc(size_t size, gfp_t gfp)
+{
+	(void)gfp;
+	return malloc(size);
+}
+
+static inline void *
+kmalloc_array(size_t n, size_t size, gfp_t gfp)
+{
+	(void)gfp;
+	if (size != 0 && n > SIZE_MAX / size)
+		return NULL;
+	return malloc(n * size);
+}
+
+static inline void *
+kzalloc(size_t size, gfp_t gfp)
+{
+	(void)gfp;
+	return calloc(1, size);
+}
+
+static inline void
+kfree(const void *p)
+{
+	free((void *)p);
+}
+
+/* Linux sort() takes an optional swap callback, qsort() never needs one. */
+static inline void
+sort(void *base, size_t num, size_t size,
+    int (*cmp)(const void *, const void *),
+    void (*swap_fn)(void *, void *, int))
+{
+	(void)swap_fn;
+	qsort(base, num, size, cmp);
+}
+
+/*
+ * CONFIG_DRM_DEBUG_MM records the allocating stack of every node; there is no
+ * stack depot here, so the records are empty and leaks report an unknown owner.
+ */
+typedef u32 depot_stack_handle_t;
+
+static inline unsigned int
+stack_trace_save(unsigned long *store, unsigned int size, unsigned int skip)
+{
+	(void)store; (void)size; (void)skip;
+	return 0;
+}
+
+static inline depot_stack_handle_t
+stack_depot_save(unsigned long *entries, unsigned int nr, gfp_t gfp)
+{
+	(void)entries; (void)nr; (void)gfp;
+	return 0;
+}
+
+static inline unsigned int
+stack_depot_fetch(depot_stack_handle_t handle, unsigned long **entries)
+{
+	(void)handle;
+	*entries = NULL;
+	return 0;
+}
+
+static inline int
+stack_trace_snprint(char *buf, size_t size, const unsigned long *entries,
+    unsigned int nr, int spaces)
+{
+	(void)entries; (void)nr; (void)spaces;
+	return snprintf(buf, size, "\n");
+}
+
+#define DRM_ERROR(fmt, ...)	fprintf(stderr, "drm_mm: " fmt, ##__VA_ARGS__)
+
+struct drm_printer {
+	FILE *f;
+};
+
+static inline void
+drm_printf(struct drm_printer *p, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(p->f, fmt, ap);
+	va_end(ap);
+}
+
+#endif /* _BENCH_COMPAT_H_ */
@@ -0,0 +1,3 @@
+/* SPDX-License-Identifier: MIT */
+/* The real LinuxKPI header, built against the shims in this directory. */
+#include "../../../../linuxkpi/gplv2/include/linux/rbtree.h"
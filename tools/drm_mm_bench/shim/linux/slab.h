@@ -0,0 +1,2 @@
+/* SPDX-License-Identifier: MIT */
+#include "../bench_compat.h"
@@ -0,0 +1,2 @@
+/* SPDX-License-Identifier: MIT */
+/* Pulled in by the LinuxKPI rbtree.h, nothing from it is needed here. */